@@ -0,0 +1,499 @@
+#include "asynclogger.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+
+#include "memory.h"
+#include "systemexception.h"
+
+namespace
+{
+
+const char binary_magic[8] = { 'R', 'L', 'O', 'G', 'B', 'I', 'N', '1' };
+
+const uint32_t text_record = 0;
+const uint32_t definition_record = 0xffffffff;
+
+struct RecordHeader
+{
+    uint32_t size;
+    uint32_t id;
+    uint64_t time;
+};
+
+// Single-producer single-consumer byte ring. Positions only grow; the index
+// into data is position & mask.
+struct Ring
+{
+    explicit Ring(size_t capacity)
+        : data(new char[capacity])
+        , capacity(capacity)
+        , mask(capacity - 1)
+        , head(0)
+        , tail(0)
+        , closed(false)
+    {
+        Memory::charge(Memory::logger, sizeof(Ring) + capacity);
+    }
+
+    ~Ring()
+    {
+        delete[] data;
+        Memory::release(Memory::logger, sizeof(Ring) + capacity);
+    }
+
+    void copy(uint64_t pos, const char * src, size_t size)
+    {
+        if(size == 0)
+            return;
+        size_t start = pos & mask;
+        size_t first = std::min(size, capacity - start);
+        std::memcpy(data + start, src, first);
+        std::memcpy(data, src + first, size - first);
+    }
+
+    char * data;
+    size_t capacity;
+    size_t mask;
+
+    // Written by the producer only; padded so producer and writer do not
+    // share a cache line.
+    char pad1[64];
+    std::atomic<uint64_t> head;
+
+    // Written by the writer thread only.
+    char pad2[64];
+    std::atomic<uint64_t> tail;
+
+    // Set when the producing thread exited.
+    std::atomic<bool> closed;
+};
+
+struct Definition
+{
+    int32_t level;
+    int32_t line;
+    std::string file;
+    std::string fmt;
+};
+
+struct State
+{
+    State()
+        : running(false)
+        , stopping(false)
+        , fd(-1)
+        , own_fd(false)
+        , policy(AsyncLogger::drop)
+        , format(AsyncLogger::text)
+        , ring_size(0)
+        , dropped(0)
+        , reported_dropped(0)
+    {
+    }
+
+    // Guards rings, stopping and the writer wakeup.
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    std::vector<Ring *> rings;
+    std::thread writer;
+
+    std::atomic<bool> running;
+    bool stopping;
+    int fd;
+    bool own_fd;
+    AsyncLogger::Policy policy;
+    AsyncLogger::Format format;
+    size_t ring_size;
+
+    // Deferred format strings, id i at index i - 1. Guarded by mutex.
+    std::vector<Definition> definitions;
+
+    std::atomic<uint64_t> dropped;
+    uint64_t reported_dropped;
+};
+
+State & state()
+{
+    static State s;
+    return s;
+}
+
+struct RingHolder
+{
+    RingHolder()
+        : ring(0)
+    {
+    }
+
+    ~RingHolder()
+    {
+        if(ring)
+            ring->closed.store(true, std::memory_order_release);
+    }
+
+    Ring * ring;
+};
+
+thread_local RingHolder holder;
+
+Ring * local_ring()
+{
+    if(!holder.ring)
+    {
+        State & s = state();
+        size_t size = 64;
+        while(size < s.ring_size)
+            size <<= 1;
+
+        std::lock_guard<std::mutex> lock(s.mutex);
+        holder.ring = new Ring(size);
+        s.rings.push_back(holder.ring);
+    }
+    return holder.ring;
+}
+
+void write_all(int fd, iovec * iov, int count)
+{
+    while(count > 0)
+    {
+        ssize_t n = ::writev(fd, iov, count);
+        if(n < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            return;
+        }
+
+        while(count > 0 && (size_t)n >= iov->iov_len)
+        {
+            n -= iov->iov_len;
+            ++iov;
+            --count;
+        }
+        if(count > 0)
+        {
+            iov->iov_base = static_cast<char *>(iov->iov_base) + n;
+            iov->iov_len -= n;
+        }
+    }
+}
+
+// Write out what the rings hold, gathering up to max_iov spans per writev.
+// A ring adds one or two spans, so a batch holds at most max_iov rings.
+void drain(State & s, const std::vector<Ring *> & rings)
+{
+    enum { max_iov = 64 };
+    iovec iov[max_iov];
+    Ring * batch[max_iov];
+    uint64_t heads[max_iov];
+    int count = 0;
+    int batch_size = 0;
+
+    auto flush = [&]() {
+        write_all(s.fd, iov, count);
+        for(int i = 0; i < batch_size; ++i)
+            batch[i]->tail.store(heads[i], std::memory_order_release);
+        count = 0;
+        batch_size = 0;
+    };
+
+    for(Ring * ring : rings)
+    {
+        uint64_t head = ring->head.load(std::memory_order_acquire);
+        uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+        if(head == tail)
+            continue;
+
+        size_t size = head - tail;
+        size_t start = tail & ring->mask;
+        size_t first = std::min(size, ring->capacity - start);
+        iov[count].iov_base = ring->data + start;
+        iov[count++].iov_len = first;
+        if(size > first)
+        {
+            iov[count].iov_base = ring->data;
+            iov[count++].iov_len = size - first;
+        }
+        batch[batch_size] = ring;
+        heads[batch_size++] = head;
+
+        if(count > max_iov - 2)
+            flush();
+    }
+    flush();
+
+    uint64_t dropped = s.dropped.load(std::memory_order_relaxed);
+    if(dropped != s.reported_dropped && s.format == AsyncLogger::text)
+    {
+        std::string line = "[warn ] async logger dropped "
+            + std::to_string(dropped - s.reported_dropped) + " lines\n";
+        s.reported_dropped = dropped;
+        iovec warn = { &line[0], line.size() };
+        write_all(s.fd, &warn, 1);
+    }
+}
+
+void run_writer()
+{
+    State & s = state();
+    for(;;)
+    {
+        std::vector<Ring *> rings;
+        bool stopping;
+        {
+            std::unique_lock<std::mutex> lock(s.mutex);
+            if(!s.stopping)
+                s.wakeup.wait_for(lock, std::chrono::milliseconds(10));
+            rings = s.rings;
+            stopping = s.stopping;
+        }
+
+        drain(s, rings);
+
+        // Release rings of exited threads once they are empty.
+        {
+            std::lock_guard<std::mutex> lock(s.mutex);
+            for(size_t i = 0; i < s.rings.size();)
+            {
+                Ring * ring = s.rings[i];
+                if(ring->closed.load(std::memory_order_acquire)
+                   && ring->head.load(std::memory_order_acquire) == ring->tail.load(std::memory_order_relaxed))
+                {
+                    delete ring;
+                    s.rings[i] = s.rings.back();
+                    s.rings.pop_back();
+                }
+                else
+                {
+                    ++i;
+                }
+            }
+        }
+
+        if(stopping)
+            break;
+    }
+}
+
+// Queue the concatenation of parts as one unit in the calling thread's ring.
+bool push(const iovec * parts, int count)
+{
+    State & s = state();
+    Ring * ring = local_ring();
+
+    size_t size = 0;
+    for(int i = 0; i < count; ++i)
+        size += parts[i].iov_len;
+    if(size > ring->capacity)
+    {
+        s.dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    uint64_t head = ring->head.load(std::memory_order_relaxed);
+    uint64_t tail = ring->tail.load(std::memory_order_acquire);
+    while(ring->capacity - (head - tail) < size)
+    {
+        if(s.policy == AsyncLogger::drop || !s.running.load(std::memory_order_relaxed))
+        {
+            s.dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        s.wakeup.notify_one();
+        std::this_thread::yield();
+        tail = ring->tail.load(std::memory_order_acquire);
+    }
+
+    uint64_t pos = head;
+    for(int i = 0; i < count; ++i)
+    {
+        ring->copy(pos, static_cast<const char *>(parts[i].iov_base), parts[i].iov_len);
+        pos += parts[i].iov_len;
+    }
+    ring->head.store(pos, std::memory_order_release);
+
+    // Wake the writer early when the ring passes half full, otherwise it
+    // picks the data up on its next periodic round.
+    size_t half = ring->capacity / 2;
+    if(head - tail < half && head - tail + size >= half)
+        s.wakeup.notify_one();
+    return true;
+}
+
+// Frame up to three payload parts as a binary record.
+bool push_record(uint32_t id, const iovec * payload, int count)
+{
+    RecordHeader header;
+    header.size = sizeof(header) - sizeof(header.size);
+    for(int i = 0; i < count; ++i)
+        header.size += payload[i].iov_len;
+    header.id = id;
+    timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    header.time = now.tv_sec * 1000000000ULL + now.tv_nsec;
+
+    iovec parts[4] = { { &header, sizeof(header) } };
+    for(int i = 0; i < count && i < 3; ++i)
+        parts[i + 1] = payload[i];
+    return push(parts, count + 1);
+}
+
+void append_string(std::string & out, const std::string & s)
+{
+    uint16_t size = s.size() > 0xffff ? 0xffff : s.size();
+    out.append(reinterpret_cast<const char *>(&size), sizeof(size));
+    out.append(s.data(), size);
+}
+
+std::string encode_definition(uint32_t id, const Definition & d)
+{
+    std::string out;
+    out.append(reinterpret_cast<const char *>(&id), sizeof(id));
+    out.append(reinterpret_cast<const char *>(&d.level), sizeof(d.level));
+    out.append(reinterpret_cast<const char *>(&d.line), sizeof(d.line));
+    append_string(out, d.file);
+    append_string(out, d.fmt);
+    return out;
+}
+
+// Write the file header and all definitions so far, framed like records.
+void write_preamble(State & s)
+{
+    std::string out(binary_magic, sizeof(binary_magic));
+    for(size_t i = 0; i < s.definitions.size(); ++i)
+    {
+        std::string payload = encode_definition(i + 1, s.definitions[i]);
+        RecordHeader header;
+        header.size = sizeof(header) - sizeof(header.size) + payload.size();
+        header.id = definition_record;
+        header.time = 0;
+        out.append(reinterpret_cast<const char *>(&header), sizeof(header));
+        out.append(payload);
+    }
+    iovec part = { &out[0], out.size() };
+    write_all(s.fd, &part, 1);
+}
+
+}
+
+void AsyncLogger::start(int fd, Policy policy, size_t ring_size, Format format)
+{
+    stop();
+
+    State & s = state();
+    s.fd = fd;
+    s.own_fd = false;
+    s.policy = policy;
+    s.ring_size = ring_size;
+    s.stopping = false;
+    s.reported_dropped = s.dropped.load();
+    s.format = format;
+
+    // Under the mutex so register_format() either sees the writer running or
+    // has its definition in the preamble.
+    std::lock_guard<std::mutex> lock(s.mutex);
+    if(format == binary)
+        write_preamble(s);
+    s.writer = std::thread(run_writer);
+    s.running.store(true, std::memory_order_release);
+}
+
+void AsyncLogger::start(const std::string & path, Policy policy, size_t ring_size, Format format)
+{
+    int flags = O_WRONLY | O_CREAT | O_CLOEXEC | (format == binary ? O_TRUNC : O_APPEND);
+    int fd = ::open(path.c_str(), flags, 0644);
+    if(fd == -1)
+        throw_error(errno, "async logger: open");
+    start(fd, policy, ring_size, format);
+    state().own_fd = true;
+}
+
+void AsyncLogger::stop()
+{
+    State & s = state();
+    if(!s.running.load(std::memory_order_acquire))
+        return;
+
+    s.running.store(false, std::memory_order_release);
+    {
+        std::lock_guard<std::mutex> lock(s.mutex);
+        s.stopping = true;
+    }
+    s.wakeup.notify_one();
+    s.writer.join();
+
+    if(s.own_fd)
+        ::close(s.fd);
+    s.fd = -1;
+}
+
+bool AsyncLogger::running()
+{
+    return state().running.load(std::memory_order_acquire);
+}
+
+bool AsyncLogger::append(const char * data1, size_t size1,
+                         const char * data2, size_t size2)
+{
+    if(state().format == binary)
+    {
+        iovec parts[2] = { { const_cast<char *>(data1), size1 },
+                           { const_cast<char *>(data2), size2 } };
+        return push_record(text_record, parts, 2);
+    }
+
+    iovec parts[3] = { { const_cast<char *>(data1), size1 },
+                       { const_cast<char *>(data2), size2 },
+                       { const_cast<char *>("\n"), 1 } };
+    return push(parts, 3);
+}
+
+AsyncLogger::Format AsyncLogger::format()
+{
+    return state().format;
+}
+
+uint32_t AsyncLogger::register_format(int level, const char * file, int line, const char * fmt)
+{
+    State & s = state();
+    Definition d = { level, line, file, fmt };
+    uint32_t id;
+    bool active;
+    {
+        std::lock_guard<std::mutex> lock(s.mutex);
+        s.definitions.push_back(d);
+        id = s.definitions.size();
+        active = s.running.load(std::memory_order_relaxed) && s.format == binary;
+    }
+
+    // Definitions registered before start() are written by start().
+    if(active)
+    {
+        std::string payload = encode_definition(id, d);
+        iovec part = { &payload[0], payload.size() };
+        push_record(definition_record, &part, 1);
+    }
+    return id;
+}
+
+bool AsyncLogger::append_record(uint32_t id, const char * args, size_t size)
+{
+    iovec part = { const_cast<char *>(args), size };
+    return push_record(id, &part, 1);
+}
+
+uint64_t AsyncLogger::dropped()
+{
+    return state().dropped.load(std::memory_order_relaxed);
+}
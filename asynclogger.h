@@ -0,0 +1,78 @@
+#ifndef ASYNCLOGGER_H
+#define ASYNCLOGGER_H
+
+#include <cstddef>
+#include <stdint.h>
+#include <string>
+
+// Background log writer. Each logging thread copies finished lines into its
+// own lock-free single-producer ring; one writer thread drains all rings
+// with batched writev, so logging costs the caller a memcpy and no syscall.
+//
+// In binary format the output starts with the magic "RLOGBIN1", followed by
+// records of
+//   uint32 size   bytes after this field
+//   uint32 id     0 for a text line, 0xffffffff for a format definition,
+//                 else the id from register_format()
+//   uint64 time   nanoseconds since the epoch
+//   payload       the line, the definition (uint32 id, int32 level,
+//                 int32 line, string file, string format) or the encoded
+//                 arguments, see deferredlog.h
+// with strings as uint16 size and bytes, all in host byte order. The
+// log_decode tool turns it back into text.
+class AsyncLogger
+{
+public:
+    // What append() does when the calling thread's ring is full.
+    enum Policy
+    {
+        // Discard the line and count it in dropped().
+        drop,
+
+        // Wait for the writer to make room.
+        block
+    };
+
+    enum Format
+    {
+        // Lines of text.
+        text,
+
+        // Framed records, deferred log arguments are formatted offline.
+        binary
+    };
+
+    // Start writing to fd, e.g. STDOUT_FILENO. The caller keeps owning fd.
+    static void start(int fd, Policy policy = drop, size_t ring_size = 1 << 18,
+                      Format format = text);
+
+    // Start writing to the file at path, appending text or replacing a binary
+    // log. Throws SystemException when it cannot be opened.
+    static void start(const std::string & path, Policy policy = drop, size_t ring_size = 1 << 18,
+                      Format format = text);
+
+    // Write out everything queued and stop the writer thread. Call once no
+    // thread logs anymore.
+    static void stop();
+
+    static bool running();
+
+    // Queue one line made of up to two parts, e.g. a prefix and the message;
+    // the newline is added. Returns false if the line was dropped.
+    static bool append(const char * data1, size_t size1,
+                       const char * data2 = 0, size_t size2 = 0);
+
+    static Format format();
+
+    // Register the format string of a deferred log call site, returning its
+    // record id.
+    static uint32_t register_format(int level, const char * file, int line, const char * fmt);
+
+    // Queue a binary record of encoded arguments for a registered format.
+    static bool append_record(uint32_t id, const char * args, size_t size);
+
+    // Lines lost to full rings so far.
+    static uint64_t dropped();
+};
+
+#endif // ASYNCLOGGER_H
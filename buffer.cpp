@@ -0,0 +1,62 @@
+#include "buffer.h"
+
+#include <new>
+#include <unistd.h>
+
+#include "memory.h"
+
+namespace
+{
+
+detail::ObjectPool<Buffer> & buffer_pool()
+{
+    static thread_local detail::ObjectPool<Buffer> pool;
+    return pool;
+}
+
+}
+
+Buffer * Buffer::alloc()
+{
+    Buffer * b = buffer_pool().alloc();
+    b->size = 0;
+    b->kind = memory;
+    b->fd = -1;
+    b->offset = 0;
+    b->close_fd = false;
+    return b;
+}
+
+Buffer * Buffer::try_alloc()
+{
+    if(!buffer_pool().has_free() && !Memory::allows(Memory::buffers, sizeof(Buffer)))
+        return 0;
+    return alloc();
+}
+
+size_t Buffer::trim_pool()
+{
+    return buffer_pool().trim();
+}
+
+void * Buffer::operator new(size_t size)
+{
+    void * p = ::operator new(size);
+    Memory::charge(Memory::buffers, sizeof(Buffer));
+    return p;
+}
+
+void Buffer::operator delete(void * p)
+{
+    Memory::release(Memory::buffers, sizeof(Buffer));
+    ::operator delete(p);
+}
+
+void Buffer::destroy()
+{
+    if(close_fd && fd != -1)
+        ::close(fd);
+    fd = -1;
+    close_fd = false;
+    buffer_pool().free(this);
+}
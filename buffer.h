@@ -0,0 +1,72 @@
+#ifndef BUFFER_H
+#define BUFFER_H
+
+#include <cstddef>
+#include <sys/types.h>
+
+#include "noncopyable.h"
+#include "queue.h"
+#include "objectpool.h"
+
+class Buffer : private Noncopyable
+{
+    friend class detail::QueueAccess;
+    friend class detail::ObjectPoolAccess;
+public:
+    enum { max_size = 256, };
+
+    // What a queued buffer carries.
+    enum Kind
+    {
+        // size bytes of data.
+        memory,
+
+        // size bytes of a regular file starting at offset, sent with sendfile.
+        file,
+
+        // size bytes read from a pipe, socket or device, sent with splice.
+        stream
+    };
+
+    Buffer()
+        : size(0)
+        , kind(memory)
+        , fd(-1)
+        , offset(0)
+        , close_fd(false)
+    {
+    }
+
+    // Get a cleared buffer from the calling thread's pool.
+    static Buffer * alloc();
+
+    // Like alloc(), but returns 0 rather than create a buffer past the
+    // Memory::buffers budget.
+    static Buffer * try_alloc();
+
+    // Destroy the buffers of the calling thread's pool that stayed unused
+    // since the previous call. Returns how many.
+    static size_t trim_pool();
+
+    // Accounted to Memory::buffers.
+    static void * operator new(size_t size);
+    static void operator delete(void * p);
+
+    // Return the buffer to the calling thread's pool, closing fd if owned.
+    void destroy();
+
+    char data[max_size];
+    size_t size;
+
+    Kind kind;
+    int fd;
+    off_t offset;
+    bool close_fd;
+
+private:
+    Buffer * next_;
+    Buffer * prev;
+    Buffer * next;
+};
+
+#endif // BUFFER_H
@@ -0,0 +1,48 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <stdint.h>
+#include <time.h>
+
+// Nanoseconds on the monotonic clock, which starts at an unspecified point
+// and does not jump when the wall clock is set or slewed. The time type of
+// timers, timeouts, idle tracking and rate limits. Reactor::now() gives the
+// loop's cached reading; detail::TscClock measures short intervals.
+typedef int64_t MonoTime;
+
+class MonoClock
+{
+public:
+    enum : int64_t
+    {
+        ns_per_us = 1000,
+        ns_per_ms = 1000000,
+        ns_per_s = 1000000000
+    };
+
+    // CLOCK_MONOTONIC.
+    static MonoTime now()
+    {
+        return read(CLOCK_MONOTONIC);
+    }
+
+    // CLOCK_MONOTONIC_COARSE: the time of the last scheduler tick, a few
+    // milliseconds behind, for about a third of the cost.
+    static MonoTime coarse_now()
+    {
+        return read(CLOCK_MONOTONIC_COARSE);
+    }
+
+    static MonoTime seconds(int64_t s) { return s * ns_per_s; }
+    static MonoTime milliseconds(int64_t ms) { return ms * ns_per_ms; }
+
+private:
+    static MonoTime read(clockid_t clock)
+    {
+        timespec ts;
+        clock_gettime(clock, &ts);
+        return MonoTime(ts.tv_sec) * ns_per_s + ts.tv_nsec;
+    }
+};
+
+#endif // CLOCK_H
@@ -0,0 +1,176 @@
+#ifndef CONNECTIONTABLE_H
+#define CONNECTIONTABLE_H
+
+#include <cassert>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <stdint.h>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "noncopyable.h"
+
+// Owns the connections of one reactor. Objects are constructed in place in
+// slabs of SlabSize slots that never move, so pointers stay valid and
+// inserting allocates only when a new slab is needed. A live object is also
+// listed in a dense array, which makes iteration a linear scan and erase a
+// swap with the last entry.
+//
+// An Id combines the slot with a generation that changes every time the
+// slot is reused, so an Id kept by a timer, a queue or another thread goes
+// stale instead of pointing at a newer connection. Ids are plain values
+// and may be passed anywhere; the table itself belongs to one thread.
+template <typename T, size_t SlabSize = 256>
+class ConnectionTable : private Noncopyable
+{
+public:
+    // Generation in the high 32 bits, slot in the low 32. 0 is never an id.
+    typedef uint64_t Id;
+
+    ConnectionTable()
+        : free_(npos)
+    {
+    }
+
+    // Destroys the remaining objects.
+    ~ConnectionTable()
+    {
+        while(!dense_.empty())
+            erase(object(dense_.back()));
+    }
+
+    // Construct a T from args in a free slot.
+    template <typename... Args>
+    T * emplace(Args &&... args)
+    {
+        if(free_ == npos)
+            grow();
+        uint32_t slot = free_;
+        Entry & e = entry(slot);
+
+        // The constructor may throw; the slot stays free then.
+        new (&e.storage) T(std::forward<Args>(args)...);
+        free_ = e.link;
+        e.link = uint32_t(dense_.size());
+        e.live = true;
+        dense_.push_back(slot);
+        return object(slot);
+    }
+
+    Id id(const T * object) const
+    {
+        const Entry * e = reinterpret_cast<const Entry *>(object);
+        return (Id(e->generation) << 32) | e->slot;
+    }
+
+    // The object with id, null when it was erased since.
+    T * get(Id id) const
+    {
+        uint32_t slot = uint32_t(id);
+        if(slot >= slabs_.size() * SlabSize)
+            return 0;
+        const Entry & e = entry(slot);
+        if(!e.live || e.generation != uint32_t(id >> 32))
+            return 0;
+        return object(slot);
+    }
+
+    // Destroy the object with id; false when it was already gone.
+    bool erase(Id id)
+    {
+        T * o = get(id);
+        if(!o)
+            return false;
+        erase(o);
+        return true;
+    }
+
+    // Destroy object, which must live in this table.
+    void erase(T * object)
+    {
+        Entry * e = reinterpret_cast<Entry *>(object);
+        assert(e->live);
+
+        // Unlist first, so the destructor may look at the table.
+        uint32_t index = e->link;
+        uint32_t last = dense_.back();
+        dense_[index] = last;
+        entry(last).link = index;
+        dense_.pop_back();
+
+        e->live = false;
+        if(++e->generation == 0)
+            e->generation = 1;
+        e->link = free_;
+        free_ = e->slot;
+
+        object->~T();
+    }
+
+    size_t size() const { return dense_.size(); }
+    bool empty() const { return dense_.empty(); }
+
+    // Call f(T &) for every object. f may erase the object it is given,
+    // but no other.
+    template <typename F>
+    void for_each(F f)
+    {
+        for(size_t i = dense_.size(); i-- > 0;)
+            f(*object(dense_[i]));
+    }
+
+private:
+    enum : uint32_t { npos = 0xffffffff };
+
+    // storage comes first, so a T * is also its Entry *.
+    struct Entry
+    {
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+        uint32_t slot;
+        uint32_t generation;
+
+        // Position in dense_ while live, the next free slot otherwise.
+        uint32_t link;
+        bool live;
+    };
+
+    struct Slab
+    {
+        Entry entries[SlabSize];
+    };
+
+    Entry & entry(uint32_t slot) const
+    {
+        return slabs_[slot / SlabSize]->entries[slot % SlabSize];
+    }
+
+    T * object(uint32_t slot) const
+    {
+        return reinterpret_cast<T *>(&entry(slot).storage);
+    }
+
+    // Add a slab and thread its slots onto the free list, lowest first.
+    void grow()
+    {
+        uint32_t base = uint32_t(slabs_.size() * SlabSize);
+        slabs_.emplace_back(new Slab);
+        dense_.reserve(base + SlabSize);
+        for(uint32_t i = SlabSize; i-- > 0;)
+        {
+            Entry & e = slabs_.back()->entries[i];
+            e.slot = base + i;
+            e.generation = 1;
+            e.live = false;
+            e.link = free_;
+            free_ = base + i;
+        }
+    }
+
+    std::vector<std::unique_ptr<Slab> > slabs_;
+    std::vector<uint32_t> dense_;
+    uint32_t free_;
+};
+
+#endif // CONNECTIONTABLE_H
@@ -7,6 +7,15 @@
 
 #include "socketops.h"
 #include "systemexception.h"
+#include "metrics.h"
+#include "memory.h"
+
+namespace
+{
+
+Gauge timers("deadline_timers", "Live DeadlineTimer objects.");
+
+}
 
 DeadlineTimer::DeadlineTimer(Reactor & reactor)
     : reactor_(&reactor)
@@ -17,17 +26,21 @@ DeadlineTimer::DeadlineTimer(Reactor & reactor)
     throw_error(ec, "set noblocking");
     Event event = EPOLLIN | EPOLLERR | EPOLLET;
     reactor_->register_handle(this, event);
+    timers.add();
+    Memory::charge(Memory::timers, sizeof(DeadlineTimer));
 }
 
 DeadlineTimer::~DeadlineTimer()
 {
     if(timer_fd_ > 0)
         ::close(timer_fd_);
+    timers.sub();
+    Memory::release(Memory::timers, sizeof(DeadlineTimer));
 }
 
 int DeadlineTimer::do_timerfd_create()
 {
-  int fd = timerfd_create(CLOCK_REALTIME, TFD_CLOEXEC | TFD_NONBLOCK);
+  int fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
   if (fd == -1)
       throw_error(errno, "timefd");
   return fd;
@@ -35,14 +48,23 @@ int DeadlineTimer::do_timerfd_create()
 
 bool DeadlineTimer::set_interval(int seconds)
 {
-    timespec now;
-    if(clock_gettime(CLOCK_REALTIME, &now) == -1)
-        return false;
-    itimerspec val = {0};
-    val.it_value.tv_sec = now.tv_sec;
-    val.it_value.tv_nsec = now.tv_nsec;
-
-    val.it_interval.tv_sec = seconds;
-    val.it_interval.tv_nsec = 0;
-    return timerfd_settime(timer_fd_, TFD_TIMER_ABSTIME, &val, NULL) != -1;
+    return set_period(MonoClock::seconds(seconds));
+}
+
+bool DeadlineTimer::set_period(MonoTime period)
+{
+    itimerspec val = {};
+    // The smallest relative expiry, i.e. right away.
+    val.it_value.tv_nsec = 1;
+    val.it_interval.tv_sec = period / MonoClock::ns_per_s;
+    val.it_interval.tv_nsec = period % MonoClock::ns_per_s;
+    return timerfd_settime(timer_fd_, 0, &val, NULL) != -1;
+}
+
+bool DeadlineTimer::set_timeout(MonoTime delay)
+{
+    itimerspec val = {};
+    val.it_value.tv_sec = delay / MonoClock::ns_per_s;
+    val.it_value.tv_nsec = delay % MonoClock::ns_per_s;
+    return timerfd_settime(timer_fd_, 0, &val, NULL) != -1;
 }
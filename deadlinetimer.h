@@ -2,7 +2,10 @@
 #define DEADLINETIMER_H
 
 #include "reactor.h"
+#include "clock.h"
 
+// Periodic timerfd on the monotonic clock, so setting the wall clock does
+// not make it fire early, late or in a burst.
 class DeadlineTimer : public EventHandler
 {
 public:
@@ -11,7 +14,12 @@ public:
 
     virtual int handle() { return timer_fd_; }
 
+    // Expire now and then every period.
     bool set_interval(int seconds);
+    bool set_period(MonoTime period);
+
+    // Expire once after delay instead; 0 disarms the timer.
+    bool set_timeout(MonoTime delay);
 
 private:
     int do_timerfd_create();
@@ -0,0 +1,178 @@
+#ifndef DEFERREDLOG_H
+#define DEFERREDLOG_H
+
+#include <cstring>
+#include <stdint.h>
+#include <string>
+#include <type_traits>
+
+#include "logger.h"
+#include "asynclogger.h"
+
+namespace detail
+{
+
+// Deferred logging: with the AsyncLogger in binary format a call site only
+// copies its format id and raw arguments into the ring; the text is produced
+// offline by log_decode. Otherwise the line is formatted right away. "{}" in
+// the format marks where the next argument goes.
+//
+// Each argument is encoded as a one byte type followed by
+//   int_arg      int64
+//   uint_arg     uint64
+//   double_arg   double
+//   string_arg   uint16 size and bytes
+//   pointer_arg  uint64
+class DeferredLog
+{
+public:
+  enum Type
+  {
+    int_arg,
+    uint_arg,
+    double_arg,
+    string_arg,
+    pointer_arg
+  };
+
+  // Larger argument lists are truncated.
+  enum { max_args_size = 512 };
+
+  template <typename... Args>
+  static void write(uint32_t id, Logger::Level level, const char* fmt,
+      const Args&... args)
+  {
+    if (AsyncLogger::running() && AsyncLogger::format() == AsyncLogger::binary)
+    {
+      char buf[max_args_size];
+      char* p = buf;
+      encode_all(p, buf + sizeof(buf), args...);
+      AsyncLogger::append_record(id, buf, p - buf);
+    }
+    else
+    {
+      Logger&& log = Logger::make(level);
+      format(log, fmt, args...);
+    }
+  }
+
+private:
+  static void put(char*& p, char* end, Type type, const void* data, size_t size)
+  {
+    if (p + 1 + size > end)
+    {
+      p = end;
+      return;
+    }
+    *p++ = static_cast<char>(type);
+    std::memcpy(p, data, size);
+    p += size;
+  }
+
+  static void put_string(char*& p, char* end, const char* s, size_t size)
+  {
+    if (p + 3 > end)
+    {
+      p = end;
+      return;
+    }
+    size_t room = end - p - 3;
+    uint16_t n = static_cast<uint16_t>(size < room ? size : room);
+    *p++ = static_cast<char>(string_arg);
+    std::memcpy(p, &n, sizeof(n));
+    std::memcpy(p + sizeof(n), s, n);
+    p += sizeof(n) + n;
+  }
+
+  template <typename T>
+  static typename std::enable_if<std::is_integral<T>::value
+      || std::is_enum<T>::value>::type
+  encode(char*& p, char* end, const T& value)
+  {
+    if (std::is_signed<T>::value)
+    {
+      int64_t v = static_cast<int64_t>(value);
+      put(p, end, int_arg, &v, sizeof(v));
+    }
+    else
+    {
+      uint64_t v = static_cast<uint64_t>(value);
+      put(p, end, uint_arg, &v, sizeof(v));
+    }
+  }
+
+  template <typename T>
+  static typename std::enable_if<std::is_floating_point<T>::value>::type
+  encode(char*& p, char* end, const T& value)
+  {
+    double v = value;
+    put(p, end, double_arg, &v, sizeof(v));
+  }
+
+  static void encode(char*& p, char* end, const char* s)
+  {
+    if (!s)
+      s = "(null)";
+    put_string(p, end, s, std::strlen(s));
+  }
+
+  static void encode(char*& p, char* end, const std::string& s)
+  {
+    put_string(p, end, s.data(), s.size());
+  }
+
+  static void encode(char*& p, char* end, const void* ptr)
+  {
+    uint64_t v = reinterpret_cast<uintptr_t>(ptr);
+    put(p, end, pointer_arg, &v, sizeof(v));
+  }
+
+  static void encode_all(char*&, char*)
+  {
+  }
+
+  template <typename T, typename... Args>
+  static void encode_all(char*& p, char* end, const T& first,
+      const Args&... rest)
+  {
+    encode(p, end, first);
+    encode_all(p, end, rest...);
+  }
+
+  static void format(Logger& log, const char* fmt)
+  {
+    log << fmt;
+  }
+
+  template <typename T, typename... Args>
+  static void format(Logger& log, const char* fmt, const T& first,
+      const Args&... rest)
+  {
+    const char* mark = std::strstr(fmt, "{}");
+    if (!mark)
+    {
+      log << fmt;
+      return;
+    }
+    log.write(fmt, mark - fmt) << first;
+    format(log, mark + 2, rest...);
+  }
+};
+
+} // namespace detail
+
+// Log through the deferred path. The format string must be a literal; the
+// call site registers it once.
+#define LOG_DEFERRED(level, fmt, ...) \
+  do \
+  { \
+    if (Logger::is_enabled(level)) \
+    { \
+      static const uint32_t reactor_log_format_id = \
+          AsyncLogger::register_format(level, __FILE__, __LINE__, fmt); \
+      detail::DeferredLog::write(reactor_log_format_id, level, fmt, ##__VA_ARGS__); \
+    } \
+  } \
+  while (0)
+
+#endif // DEFERREDLOG_H
@@ -0,0 +1,26 @@
+#ifndef DEMANGLE_H
+#define DEMANGLE_H
+
+#include <cstdlib>
+#include <cxxabi.h>
+#include <string>
+#include <typeinfo>
+
+namespace detail
+{
+
+// Readable name of a type, e.g. "tcp::Socket", for reports.
+inline std::string demangle(const std::type_info& type)
+{
+  int status = 0;
+  char* s = abi::__cxa_demangle(type.name(), 0, 0, &status);
+  if (status != 0)
+    return type.name();
+  std::string result(s);
+  std::free(s);
+  return result;
+}
+
+} // namespace detail
+
+#endif // DEMANGLE_H
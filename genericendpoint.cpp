@@ -0,0 +1,116 @@
+#include "genericendpoint.h"
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <cstddef>
+#include <cstring>
+
+#include "error.h"
+#include "socketops.h"
+#include "systemexception.h"
+
+GenericEndpoint::GenericEndpoint()
+    : size_(0)
+{
+    std::memset(&addr_, 0, sizeof(addr_));
+    addr_.ss_family = AF_UNSPEC;
+}
+
+GenericEndpoint::GenericEndpoint(const std::string & ip, unsigned short port)
+{
+    std::memset(&addr_, 0, sizeof(addr_));
+
+    sockaddr_in * v4 = reinterpret_cast<sockaddr_in *>(&addr_);
+    sockaddr_in6 * v6 = reinterpret_cast<sockaddr_in6 *>(&addr_);
+    if(inet_pton(AF_INET, ip.c_str(), &v4->sin_addr) == 1)
+    {
+        v4->sin_family = AF_INET;
+        v4->sin_port = htons(port);
+        size_ = sizeof(sockaddr_in);
+    }
+    else if(inet_pton(AF_INET6, ip.c_str(), &v6->sin6_addr) == 1)
+    {
+        v6->sin6_family = AF_INET6;
+        v6->sin6_port = htons(port);
+        size_ = sizeof(sockaddr_in6);
+    }
+    else
+    {
+        throw_error(detail::error::invalid_argument, "bad endpoint");
+    }
+}
+
+GenericEndpoint GenericEndpoint::local(const std::string & path)
+{
+    GenericEndpoint ep;
+    socket_ops::sockaddr_un_type * un = reinterpret_cast<socket_ops::sockaddr_un_type *>(&ep.addr_);
+    if(path.empty() || path.size() >= sizeof(un->sun_path))
+        throw_error(detail::error::invalid_argument, "bad unix endpoint");
+
+    un->sun_family = AF_UNIX;
+    std::memcpy(un->sun_path, path.data(), path.size());
+    if(path[0] == '@')
+    {
+        // Abstract names are not null terminated, the size delimits them.
+        un->sun_path[0] = '\0';
+        ep.size_ = offsetof(socket_ops::sockaddr_un_type, sun_path) + path.size();
+    }
+    else
+    {
+        ep.size_ = offsetof(socket_ops::sockaddr_un_type, sun_path) + path.size() + 1;
+    }
+    return ep;
+}
+
+unsigned short GenericEndpoint::port() const
+{
+    switch(family())
+    {
+    case AF_INET:
+        return ntohs(reinterpret_cast<const sockaddr_in *>(&addr_)->sin_port);
+    case AF_INET6:
+        return ntohs(reinterpret_cast<const sockaddr_in6 *>(&addr_)->sin6_port);
+    default:
+        return 0;
+    }
+}
+
+bool GenericEndpoint::is_local_path() const
+{
+    const socket_ops::sockaddr_un_type * un = reinterpret_cast<const socket_ops::sockaddr_un_type *>(&addr_);
+    return family() == AF_UNIX
+        && size_ > offsetof(socket_ops::sockaddr_un_type, sun_path)
+        && un->sun_path[0] != '\0';
+}
+
+std::string GenericEndpoint::to_string() const
+{
+    char buf[INET6_ADDRSTRLEN];
+    switch(family())
+    {
+    case AF_INET:
+        inet_ntop(AF_INET, &reinterpret_cast<const sockaddr_in *>(&addr_)->sin_addr, buf, sizeof(buf));
+        return std::string(buf) + ":" + std::to_string(port());
+    case AF_INET6:
+        inet_ntop(AF_INET6, &reinterpret_cast<const sockaddr_in6 *>(&addr_)->sin6_addr, buf, sizeof(buf));
+        return "[" + std::string(buf) + "]:" + std::to_string(port());
+    case AF_UNIX:
+    {
+        const socket_ops::sockaddr_un_type * un = reinterpret_cast<const socket_ops::sockaddr_un_type *>(&addr_);
+        size_t offset = offsetof(socket_ops::sockaddr_un_type, sun_path);
+        if(size_ <= offset)
+            return "";
+        if(un->sun_path[0] == '\0')
+            return "@" + std::string(un->sun_path + 1, size_ - offset - 1);
+        // A path bound to its full length has no terminator.
+        return std::string(un->sun_path, ::strnlen(un->sun_path, size_ - offset));
+    }
+    default:
+        return "";
+    }
+}
+
+bool GenericEndpoint::operator==(const GenericEndpoint & other) const
+{
+    return size_ == other.size_ && std::memcmp(&addr_, &other.addr_, size_) == 0;
+}
@@ -0,0 +1,50 @@
+#ifndef GENERICENDPOINT_H
+#define GENERICENDPOINT_H
+
+#include <string>
+#include <sys/socket.h>
+
+// A socket address of any family: IPv4, IPv6 or a Unix domain socket. The
+// address is resolved once on construction and handed to the kernel as is.
+class GenericEndpoint
+{
+public:
+    GenericEndpoint();
+
+    // Numeric IPv4 or IPv6 address, throws SystemException when ip is
+    // neither.
+    GenericEndpoint(const std::string & ip, unsigned short port);
+
+    // Unix domain socket at path. A leading '@' selects the abstract
+    // namespace, which needs no file system entry.
+    static GenericEndpoint local(const std::string & path);
+
+    int family() const { return addr_.ss_family; }
+
+    sockaddr * data() { return reinterpret_cast<sockaddr *>(&addr_); }
+    const sockaddr * data() const { return reinterpret_cast<const sockaddr *>(&addr_); }
+
+    socklen_t size() const { return size_; }
+    socklen_t capacity() const { return sizeof(addr_); }
+
+    // Set the used size after the kernel filled in data(), e.g. from accept.
+    void resize(socklen_t size) { size_ = size; }
+
+    // The port of an IP endpoint, 0 otherwise.
+    unsigned short port() const;
+
+    // Whether this is a Unix domain socket bound to a file system path.
+    bool is_local_path() const;
+
+    // "1.2.3.4:80", "[::1]:80", "/path" or "@abstract".
+    std::string to_string() const;
+
+    bool operator==(const GenericEndpoint & other) const;
+    bool operator!=(const GenericEndpoint & other) const { return !(*this == other); }
+
+private:
+    sockaddr_storage addr_;
+    socklen_t size_;
+};
+
+#endif // GENERICENDPOINT_H
@@ -0,0 +1,127 @@
+#ifndef HANDLERPOOL_H
+#define HANDLERPOOL_H
+
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+#include "reactor.h"
+#include "connectiontable.h"
+#include "memory.h"
+#include "noncopyable.h"
+
+// Constructs handlers of one type for one reactor in a ConnectionTable, so
+// accepting and closing connections reuse slots instead of going to the
+// global allocator. destroy() deregisters the handler right away but runs
+// its destructor and frees the slot only after the reactor finished the
+// current batch: a handler may destroy itself, or another handler, from
+// handle_events() and the object stays valid until nothing on the stack
+// can refer to it. Handlers left when the pool is destroyed are destroyed
+// with it; destroy the pool outside the reactor's run(). Live handlers are
+// accounted to Memory::connections.
+template <typename T, size_t SlabSize = 256>
+class HandlerPool : public HandlerReleaser, private Noncopyable
+{
+public:
+    typedef typename ConnectionTable<T, SlabSize>::Id Id;
+
+    explicit HandlerPool(Reactor & reactor)
+        : reactor_(reactor)
+        , dying_count_(0)
+        , iterating_(false)
+    {
+    }
+
+    ~HandlerPool()
+    {
+        Memory::release(Memory::connections, table_.size() * sizeof(T));
+    }
+
+    // Construct a T from args; 0 when it would exceed the memory budget.
+    template <typename... Args>
+    T * create(Args &&... args)
+    {
+        if(!Memory::allows(Memory::connections, sizeof(T)))
+            return 0;
+        T * handler = table_.emplace(std::forward<Args>(args)...);
+        Memory::charge(Memory::connections, sizeof(T));
+        size_t slot = uint32_t(table_.id(handler));
+        if(slot >= dying_.size())
+            dying_.resize(slot + 1, false);
+        return handler;
+    }
+
+    // Deregister handler and destroy it after the current batch. Further
+    // calls for the same handler until then do nothing.
+    void destroy(T * handler)
+    {
+        size_t slot = uint32_t(table_.id(handler));
+        if(dying_[slot])
+            return;
+        dying_[slot] = true;
+        ++dying_count_;
+        reactor_.deregister_handle(handler);
+        if(iterating_)
+            deferred_.push_back(handler);
+        else
+            reactor_.defer_release(handler, *this);
+    }
+
+    Id id(const T * handler) const { return table_.id(handler); }
+
+    // The handler with id, null once it is being destroyed.
+    T * get(Id id) const
+    {
+        T * handler = table_.get(id);
+        return handler && !dying_[uint32_t(id)] ? handler : 0;
+    }
+
+    // Handlers not being destroyed.
+    size_t size() const { return table_.size() - dying_count_; }
+
+    // Call f(T &) for every handler not being destroyed; f may destroy
+    // any of them. Handlers destroyed meanwhile stay in the table until
+    // the iteration is over, also outside a batch, so it sees every slot
+    // once.
+    template <typename F>
+    void for_each(F f)
+    {
+        bool outermost = !iterating_;
+        iterating_ = true;
+        table_.for_each([&](T & handler)
+        {
+            if(!dying_[uint32_t(table_.id(&handler))])
+                f(handler);
+        });
+        if(!outermost)
+            return;
+
+        iterating_ = false;
+        for(T * handler : deferred_)
+            reactor_.defer_release(handler, *this);
+        deferred_.clear();
+    }
+
+private:
+    void release(EventHandler * handler)
+    {
+        T * t = static_cast<T *>(handler);
+        dying_[uint32_t(table_.id(t))] = false;
+        --dying_count_;
+        table_.erase(t);
+        Memory::release(Memory::connections, sizeof(T));
+    }
+
+    Reactor & reactor_;
+    ConnectionTable<T, SlabSize> table_;
+
+    // By slot: destroy() was called and the release is pending.
+    std::vector<bool> dying_;
+    size_t dying_count_;
+
+    // Destroyed during for_each(), handed to the reactor after it.
+    bool iterating_;
+    std::vector<T *> deferred_;
+};
+
+#endif // HANDLERPOOL_H
@@ -1,16 +1,123 @@
 #include "logger.h"
 
 #include <iostream>
+#include <cstdio>
+#include <cstring>
+
+#include "asynclogger.h"
 
 Mutex Logger::mutex_;
 
-Logger::Logger(const std::string &prefix)
+std::atomic<int> Logger::level_(Logger::debug_level);
+
+Logger::Logger(const char * prefix)
     : prefix_(prefix)
+    , size_(0)
 {
 }
 
 Logger::~Logger()
 {
+    if(AsyncLogger::running())
+    {
+        AsyncLogger::append(prefix_, std::strlen(prefix_), data_, size_);
+        return;
+    }
+
     Mutex::ScopedLock lock(mutex_);
-    std::cout << prefix_ << stream_.str() << std::endl;
+    std::cout << prefix_;
+    std::cout.write(data_, size_);
+    std::cout << std::endl;
+}
+
+Logger Logger::make(Level level)
+{
+    return Logger(prefix(level));
+}
+
+const char * Logger::prefix(Level level)
+{
+    switch(level)
+    {
+    case debug_level: return "[debug] ";
+    case info_level:  return "[info ] ";
+    case warn_level:  return "[warn ] ";
+    default:          return "[error] ";
+    }
+}
+
+Logger & Logger::write(const char * data, size_t size)
+{
+    append(data, size);
+    return *this;
+}
+
+Logger & Logger::operator <<(const char * s)
+{
+    if(!s)
+        s = "(null)";
+    append(s, std::strlen(s));
+    return *this;
+}
+
+Logger & Logger::operator <<(const std::string & s)
+{
+    append(s.data(), s.size());
+    return *this;
+}
+
+Logger & Logger::operator <<(char c)
+{
+    append(&c, 1);
+    return *this;
+}
+
+Logger & Logger::operator <<(double d)
+{
+    char buf[32];
+    int n = std::snprintf(buf, sizeof(buf), "%g", d);
+    append(buf, n);
+    return *this;
+}
+
+Logger & Logger::operator <<(const void * p)
+{
+    char buf[32];
+    int n = std::snprintf(buf, sizeof(buf), "%p", p);
+    append(buf, n);
+    return *this;
+}
+
+void Logger::append(const char * data, size_t size)
+{
+    if(size > max_line - size_)
+        size = max_line - size_;
+    std::memcpy(data_ + size_, data, size);
+    size_ += size;
+}
+
+void Logger::append_signed(long long value)
+{
+    if(value < 0)
+    {
+        append("-", 1);
+        append_unsigned(0ULL - static_cast<unsigned long long>(value));
+    }
+    else
+    {
+        append_unsigned(value);
+    }
+}
+
+void Logger::append_unsigned(unsigned long long value)
+{
+    char buf[24];
+    char * p = buf + sizeof(buf);
+    do
+    {
+        *--p = '0' + value % 10;
+        value /= 10;
+    }
+    while(value);
+    append(p, buf + sizeof(buf) - p);
 }
@@ -2,11 +2,31 @@
 #define LOGGER_H
 
 #include "mutex.h"
-#include <sstream>
+#include <atomic>
+#include <cstddef>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <type_traits>
+
+// Levels below REACTOR_LOG_LEVEL are compiled out of the LOG_* macros:
+// 0 debug, 1 info, 2 warn, 3 error, 4 nothing.
+#ifndef REACTOR_LOG_LEVEL
+#define REACTOR_LOG_LEVEL 0
+#endif
 
 class Logger
 {
 public:
+    enum Level
+    {
+        debug_level,
+        info_level,
+        warn_level,
+        error_level,
+        off_level
+    };
+
     ~Logger();
 
     static inline Logger debug() { return Logger("[debug] "); }
@@ -14,20 +34,109 @@ public:
     static inline Logger warn()  { return Logger("[warn ] "); }
     static inline Logger error() { return Logger("[error] "); }
 
+    static Logger make(Level level);
+
+    static const char * prefix(Level level);
+
+    // Drop levels below level at runtime.
+    static void set_level(Level level) { level_.store(level, std::memory_order_relaxed); }
+
+    // Whether level is compiled in and enabled; a constant and one relaxed
+    // load, checked before anything is formatted.
+    static bool is_enabled(Level level)
+    {
+        return level >= REACTOR_LOG_LEVEL
+            && level >= level_.load(std::memory_order_relaxed);
+    }
+
+    // Append size bytes of data verbatim.
+    Logger & write(const char * data, size_t size);
+
+    Logger & operator <<(const char * s);
+    Logger & operator <<(const std::string & s);
+    Logger & operator <<(char c);
+    Logger & operator <<(double d);
+    Logger & operator <<(const void * p);
+
+    template<class T>
+    typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value, Logger &>::type
+    operator <<(T t)
+    {
+        if(std::is_signed<T>::value)
+            append_signed(static_cast<long long>(t));
+        else
+            append_unsigned(static_cast<unsigned long long>(t));
+        return *this;
+    }
+
+    // Anything else with a stream operator is streamed straight into the
+    // line, without allocating.
     template<class T>
-    Logger & operator <<(T t)
+    typename std::enable_if<!std::is_arithmetic<T>::value && !std::is_enum<T>::value
+                            && !std::is_pointer<T>::value
+                            && !std::is_convertible<const T &, const char *>::value, Logger &>::type
+    operator <<(const T & t)
     {
-        stream_ << t;
+        LineBuf buf(*this);
+        std::ostream stream(&buf);
+        stream << t;
         return *this;
     }
 
 private:
-    Logger(const std::string & prefix);
+    class LineBuf : public std::streambuf
+    {
+    public:
+        explicit LineBuf(Logger & logger) : logger_(logger) { }
+
+    protected:
+        int_type overflow(int_type c)
+        {
+            if(!traits_type::eq_int_type(c, traits_type::eof()))
+            {
+                char ch = traits_type::to_char_type(c);
+                logger_.append(&ch, 1);
+            }
+            return traits_type::not_eof(c);
+        }
+
+        std::streamsize xsputn(const char * s, std::streamsize n)
+        {
+            logger_.append(s, n);
+            return n;
+        }
+
+    private:
+        Logger & logger_;
+    };
+
+    Logger(const char * prefix);
     Logger(Logger && other);
 
-    std::stringstream stream_;
-    std::string prefix_;
+    void append(const char * data, size_t size);
+    void append_signed(long long value);
+    void append_unsigned(unsigned long long value);
+
+    // Longer lines are truncated.
+    enum { max_line = 1024 };
+
+    const char * prefix_;
+    char data_[max_line];
+    size_t size_;
+
     static Mutex mutex_;
+    static std::atomic<int> level_;
 };
 
+// Logging statements that cost nothing when their level is disabled: the
+// operands are not evaluated, and levels below REACTOR_LOG_LEVEL are
+// constant-folded away.
+#define REACTOR_LOG(level, name) \
+    if(!Logger::is_enabled(level)) ; else Logger::name()
+
+#define LOG_DEBUG REACTOR_LOG(Logger::debug_level, debug)
+#define LOG_INFO  REACTOR_LOG(Logger::info_level, info)
+#define LOG_WARN  REACTOR_LOG(Logger::warn_level, warn)
+#define LOG_ERROR REACTOR_LOG(Logger::error_level, error)
+
 #endif // LOGGER_H
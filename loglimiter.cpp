@@ -0,0 +1,79 @@
+#include "loglimiter.h"
+
+#include "clock.h"
+
+Mutex LogLimiter::mutex_;
+
+LogLimiter * LogLimiter::limiters_ = 0;
+
+LogLimiter::LogLimiter(const char * file, int line, double rate, unsigned burst, unsigned every)
+    : file_(file)
+    , line_(line)
+    , interval_(rate > 0 ? MonoTime(MonoClock::ns_per_s / rate) : 0)
+    , window_(interval_ * (burst ? burst : 1))
+    , next_(0)
+    , every_(every ? every : 1)
+    , count_(0)
+    , suppressed_(0)
+    , prev_(0)
+    , next_limiter_(0)
+{
+    Mutex::ScopedLock lock(mutex_);
+    next_limiter_ = limiters_;
+    if(limiters_)
+        limiters_->prev_ = this;
+    limiters_ = this;
+}
+
+LogLimiter::~LogLimiter()
+{
+    Mutex::ScopedLock lock(mutex_);
+    if(prev_)
+        prev_->next_limiter_ = next_limiter_;
+    else
+        limiters_ = next_limiter_;
+    if(next_limiter_)
+        next_limiter_->prev_ = prev_;
+}
+
+bool LogLimiter::allow()
+{
+    if(every_ > 1 && count_.fetch_add(1, std::memory_order_relaxed) % every_ != 0)
+    {
+        suppressed_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    if(interval_ && !take_token())
+    {
+        suppressed_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    return true;
+}
+
+bool LogLimiter::take_token()
+{
+    MonoTime now = MonoClock::coarse_now();
+    int64_t next = next_.load(std::memory_order_relaxed);
+    for(;;)
+    {
+        int64_t updated = (next > now ? next : now) + interval_;
+        if(updated - now > window_)
+            return false;
+        if(next_.compare_exchange_weak(next, updated, std::memory_order_relaxed))
+            return true;
+    }
+}
+
+void LogLimiter::flush_suppressed()
+{
+    Mutex::ScopedLock lock(mutex_);
+    for(LogLimiter * l = limiters_; l; l = l->next_limiter_)
+    {
+        uint64_t n = l->suppressed_.exchange(0, std::memory_order_relaxed);
+        if(n)
+            Logger::warn() << l->file_ << ":" << l->line_ << " suppressed " << n << " messages";
+    }
+}
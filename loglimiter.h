@@ -0,0 +1,69 @@
+#ifndef LOGLIMITER_H
+#define LOGLIMITER_H
+
+#include <atomic>
+#include <stdint.h>
+
+#include "logger.h"
+#include "mutex.h"
+#include "noncopyable.h"
+
+// Per call site limit for log statements that can fire in storms, e.g. one
+// line per failed socket. A site passes either a token bucket (rate lines
+// per second, bursts of up to burst lines) or one line in every n, or both.
+// Lines that are held back are counted and reported by flush_suppressed().
+class LogLimiter : private Noncopyable
+{
+public:
+    LogLimiter(const char * file, int line, double rate, unsigned burst, unsigned every = 1);
+    ~LogLimiter();
+
+    // Whether the next line may be written. Lock free; the token bucket is a
+    // single compare-and-swap on a coarse monotonic clock.
+    bool allow();
+
+    uint64_t suppressed() const { return suppressed_.load(std::memory_order_relaxed); }
+
+    // Write one "suppressed N messages" line for every site that held back
+    // lines since the last call. Call periodically, e.g. from a DeadlineTimer.
+    static void flush_suppressed();
+
+private:
+    bool take_token();
+
+    const char * file_;
+    int line_;
+
+    // Token bucket as a virtual schedule: next_ is when the bucket would
+    // be full again; a line may go out while that is less than burst
+    // intervals away.
+    int64_t interval_;
+    int64_t window_;
+    std::atomic<int64_t> next_;
+
+    unsigned every_;
+    std::atomic<uint64_t> count_;
+
+    std::atomic<uint64_t> suppressed_;
+
+    LogLimiter * prev_;
+    LogLimiter * next_limiter_;
+
+    static Mutex mutex_;
+    static LogLimiter * limiters_;
+};
+
+#define REACTOR_LOG_IF(level, cond) \
+    if(!Logger::is_enabled(level) || !(cond)) ; else Logger::make(level)
+
+// At most rate lines per second from this statement, with bursts of burst.
+#define LOG_LIMITED(level, rate, burst) \
+    REACTOR_LOG_IF(level, ([]() -> LogLimiter & { \
+        static LogLimiter limiter(__FILE__, __LINE__, rate, burst); return limiter; }().allow()))
+
+// The first line from this statement and then one in every n.
+#define LOG_SAMPLED(level, n) \
+    REACTOR_LOG_IF(level, ([]() -> LogLimiter & { \
+        static LogLimiter limiter(__FILE__, __LINE__, 0, 0, n); return limiter; }().allow()))
+
+#endif // LOGLIMITER_H
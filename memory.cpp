@@ -0,0 +1,117 @@
+#include "memory.h"
+
+#include <atomic>
+
+#include "metrics.h"
+
+namespace
+{
+
+struct Account
+{
+    std::atomic<size_t> used;
+    std::atomic<size_t> budget;
+    Gauge gauge;
+
+    Account(const char * name, const char * help)
+        : used(0)
+        , budget(0)
+        , gauge(name, help)
+    {
+    }
+};
+
+Account accounts[Memory::subsystems] =
+{
+    { "memory_buffers_bytes", "Bytes held by Buffers, in use or pooled." },
+    { "memory_connections_bytes", "Bytes held by handlers in HandlerPools." },
+    { "memory_timers_bytes", "Bytes held by DeadlineTimers." },
+    { "memory_logger_bytes", "Bytes held by AsyncLogger rings." },
+};
+
+const char * const names[Memory::subsystems] = { "buffers", "connections", "timers", "logger" };
+
+std::atomic<size_t> total(0);
+std::atomic<size_t> total_budget(0);
+std::atomic<size_t> per_connection_budget(0);
+
+Counter refusals("memory_budget_refusals_total", "Allocations refused for exceeding a memory budget.");
+
+}
+
+void Memory::charge(Subsystem subsystem, size_t bytes)
+{
+    accounts[subsystem].used.fetch_add(bytes, std::memory_order_relaxed);
+    accounts[subsystem].gauge.add(bytes);
+    total.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+void Memory::release(Subsystem subsystem, size_t bytes)
+{
+    accounts[subsystem].used.fetch_sub(bytes, std::memory_order_relaxed);
+    accounts[subsystem].gauge.sub(bytes);
+    total.fetch_sub(bytes, std::memory_order_relaxed);
+}
+
+bool Memory::allows(Subsystem subsystem, size_t bytes)
+{
+    const Account & a = accounts[subsystem];
+    size_t limit = a.budget.load(std::memory_order_relaxed);
+    if(limit && a.used.load(std::memory_order_relaxed) + bytes > limit)
+    {
+        refusals.add();
+        return false;
+    }
+    limit = total_budget.load(std::memory_order_relaxed);
+    if(limit && total.load(std::memory_order_relaxed) + bytes > limit)
+    {
+        refusals.add();
+        return false;
+    }
+    return true;
+}
+
+size_t Memory::used(Subsystem subsystem)
+{
+    return accounts[subsystem].used.load(std::memory_order_relaxed);
+}
+
+size_t Memory::used()
+{
+    return total.load(std::memory_order_relaxed);
+}
+
+void Memory::set_budget(Subsystem subsystem, size_t bytes)
+{
+    accounts[subsystem].budget.store(bytes, std::memory_order_relaxed);
+}
+
+void Memory::set_budget(size_t bytes)
+{
+    total_budget.store(bytes, std::memory_order_relaxed);
+}
+
+size_t Memory::budget(Subsystem subsystem)
+{
+    return accounts[subsystem].budget.load(std::memory_order_relaxed);
+}
+
+size_t Memory::budget()
+{
+    return total_budget.load(std::memory_order_relaxed);
+}
+
+void Memory::set_connection_budget(size_t bytes)
+{
+    per_connection_budget.store(bytes, std::memory_order_relaxed);
+}
+
+size_t Memory::connection_budget()
+{
+    return per_connection_budget.load(std::memory_order_relaxed);
+}
+
+const char * Memory::name(Subsystem subsystem)
+{
+    return names[subsystem];
+}
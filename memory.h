@@ -0,0 +1,55 @@
+#ifndef MEMORY_H
+#define MEMORY_H
+
+#include <cstddef>
+
+// Process wide accounting of the memory held by the library, by subsystem:
+// buffers counts every Buffer in existence, in use or pooled; connections
+// the handlers in HandlerPools; timers the DeadlineTimers; logger the
+// AsyncLogger rings. Budgets are checked where memory can be refused, so a
+// process can be sized by them:
+//
+//   Buffer::try_alloc() returns 0 rather than grow the buffers past their
+//   budget, and tcp::Socket::receive() fails with ENOBUFS;
+//   HandlerPool::create() returns 0 rather than exceed the connections
+//   budget, and a PooledAcceptor sheds the connection.
+//
+// Anything else is charged unconditionally. The global budget covers all
+// subsystems together. 0 means no budget, the default. Budgets are soft:
+// threads charging at the same time may overshoot by one object each.
+class Memory
+{
+public:
+    enum Subsystem
+    {
+        buffers,
+        connections,
+        timers,
+        logger,
+        subsystems
+    };
+
+    static void charge(Subsystem subsystem, size_t bytes);
+    static void release(Subsystem subsystem, size_t bytes);
+
+    // Whether bytes more fit the subsystem's and the global budget.
+    static bool allows(Subsystem subsystem, size_t bytes);
+
+    static size_t used(Subsystem subsystem);
+    static size_t used();
+
+    static void set_budget(Subsystem subsystem, size_t bytes);
+    static void set_budget(size_t bytes);
+    static size_t budget(Subsystem subsystem);
+    static size_t budget();
+
+    // Bytes a tcp::Socket may queue for sending before it stops reading,
+    // the high watermark given to sockets created from now on; they resume
+    // at a quarter of it. 0, the default, leaves reading unlimited.
+    static void set_connection_budget(size_t bytes);
+    static size_t connection_budget();
+
+    static const char * name(Subsystem subsystem);
+};
+
+#endif // MEMORY_H
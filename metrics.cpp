@@ -0,0 +1,400 @@
+#include "metrics.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <vector>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "logger.h"
+
+namespace
+{
+
+// The last slots are shared by all metrics registered once the others ran
+// out, enough for the largest metric, a histogram.
+enum
+{
+    max_slots = 16384,
+    overflow_slots = Histogram::buckets + 1,
+    overflow_slot = max_slots - overflow_slots
+};
+
+// One thread's values. Only the owning thread writes, so updates are a
+// relaxed load and store; the padding keeps the shards of two threads off
+// each other's cache lines.
+struct Shard
+{
+    Shard()
+    {
+        for(size_t i = 0; i < max_slots; ++i)
+            values[i].store(0, std::memory_order_relaxed);
+    }
+
+    void add(size_t slot, uint64_t n)
+    {
+        std::atomic<uint64_t> & v = values[slot];
+        v.store(v.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    uint64_t get(size_t slot) const
+    {
+        return values[slot].load(std::memory_order_relaxed);
+    }
+
+    char pad1[64];
+    std::atomic<uint64_t> values[max_slots];
+    char pad2[64];
+
+    // Guarded by State::mutex.
+    std::string name;
+};
+
+struct Descriptor
+{
+    const char * name;
+    const char * help;
+    std::string label;
+    Metrics::Type type;
+    size_t slot;
+};
+
+bool operator <(const Descriptor & a, const Descriptor & b)
+{
+    return std::strcmp(a.name, b.name) < 0;
+}
+
+struct State
+{
+    State()
+        : next_slot(0)
+        , overflowed(false)
+    {
+        exited.name = "exited";
+    }
+
+    // Guards everything but the shard values.
+    std::mutex mutex;
+    std::vector<Descriptor> metrics;
+    size_t next_slot;
+    bool overflowed;
+    std::vector<Shard *> shards;
+
+    // Values of threads that are gone.
+    Shard exited;
+};
+
+State & state()
+{
+    static State s;
+    return s;
+}
+
+// Set once holder folded the shard at thread exit. A plain flag has no
+// destructor, so it stays readable from later thread_local destructors.
+thread_local bool shard_folded = false;
+
+struct ShardHolder
+{
+    ShardHolder()
+        : shard(0)
+    {
+    }
+
+    ~ShardHolder()
+    {
+        if(!shard)
+            return;
+
+        State & s = state();
+        std::lock_guard<std::mutex> lock(s.mutex);
+        for(size_t i = 0; i < s.next_slot; ++i)
+            s.exited.add(i, shard->get(i));
+        for(size_t i = 0; i < s.shards.size(); ++i)
+        {
+            if(s.shards[i] == shard)
+            {
+                s.shards.erase(s.shards.begin() + i);
+                break;
+            }
+        }
+        delete shard;
+        shard_folded = true;
+    }
+
+    Shard * shard;
+};
+
+thread_local ShardHolder holder;
+
+Shard * local_shard()
+{
+    if(!holder.shard)
+    {
+        Shard * shard = new Shard;
+        char name[32];
+        std::snprintf(name, sizeof(name), "thread-%ld", (long)::syscall(SYS_gettid));
+        shard->name = name;
+
+        State & s = state();
+        std::lock_guard<std::mutex> lock(s.mutex);
+        s.shards.push_back(shard);
+        holder.shard = shard;
+    }
+    return holder.shard;
+}
+
+// Add n to slot of the calling thread. Updates made after the thread's
+// shard was folded, e.g. from destructors of other thread_locals, go to the
+// exited shard directly.
+void shard_add(size_t slot, uint64_t n)
+{
+    if(!shard_folded)
+    {
+        local_shard()->add(slot, n);
+        return;
+    }
+    State & s = state();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    s.exited.add(slot, n);
+}
+
+// Metrics past the limit get the overflow slots and are left out of
+// render(), so a late registration, e.g. a handler profile, never fails.
+size_t register_metric(const char * name, const char * help, Metrics::Type type, size_t slots,
+                       const std::string & label = std::string())
+{
+    State & s = state();
+    {
+        std::lock_guard<std::mutex> lock(s.mutex);
+        if(s.next_slot + slots <= overflow_slot)
+        {
+            Descriptor d = { name, help, label, type, s.next_slot };
+            s.metrics.push_back(d);
+            s.next_slot += slots;
+            return d.slot;
+        }
+        if(s.overflowed)
+            return overflow_slot;
+        s.overflowed = true;
+    }
+    LOG_WARN << "metrics: out of slots, not reporting " << name << "{" << label
+             << "} nor any other metric that does not fit";
+    return overflow_slot;
+}
+
+// Sum of slot over all threads. Called with the mutex held.
+uint64_t total(const State & s, size_t slot)
+{
+    uint64_t sum = s.exited.get(slot);
+    for(const Shard * shard : s.shards)
+        sum += shard->get(slot);
+    return sum;
+}
+
+uint64_t total(size_t slot)
+{
+    State & s = state();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    return total(s, slot);
+}
+
+void append(std::string & out, const char * format, ...) __attribute__((format(printf, 2, 3)));
+
+void append(std::string & out, const char * format, ...)
+{
+    char buf[256];
+    va_list args;
+    va_start(args, format);
+    int n = std::vsnprintf(buf, sizeof(buf), format, args);
+    va_end(args);
+    if(n > 0)
+        out.append(buf, std::min<size_t>(n, sizeof(buf) - 1));
+}
+
+}
+
+void Metrics::set_thread_name(const std::string & name)
+{
+    Shard * shard = local_shard();
+    State & s = state();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    shard->name = name;
+}
+
+std::string Metrics::render()
+{
+    State & s = state();
+    std::lock_guard<std::mutex> lock(s.mutex);
+
+    std::vector<const Shard *> shards(s.shards.begin(), s.shards.end());
+    shards.push_back(&s.exited);
+
+    // Samples of one name have to be listed together.
+    std::vector<Descriptor> metrics(s.metrics);
+    std::stable_sort(metrics.begin(), metrics.end());
+
+    std::string out;
+    const char * last = "";
+    for(const Descriptor & d : metrics)
+    {
+        static const char * const types[] = { "counter", "gauge", "histogram" };
+        if(std::strcmp(d.name, last) != 0)
+            append(out, "# HELP %s %s\n# TYPE %s %s\n", d.name, d.help, d.name, types[d.type]);
+        last = d.name;
+
+        if(d.type == counter)
+        {
+            for(const Shard * shard : shards)
+                append(out, "%s{thread=\"%s\"} %llu\n", d.name, shard->name.c_str(),
+                       (unsigned long long)shard->get(d.slot));
+        }
+        else if(d.type == gauge)
+        {
+            for(const Shard * shard : shards)
+                append(out, "%s{thread=\"%s\"} %lld\n", d.name, shard->name.c_str(),
+                       (long long)shard->get(d.slot));
+        }
+        else
+        {
+            // Only buckets that ever saw a value are listed.
+            const char * label = d.label.c_str();
+            const char * comma = d.label.empty() ? "" : ",";
+            const char * rbrace = d.label.empty() ? "" : "}";
+            const char * lbrace = d.label.empty() ? "" : "{";
+            uint64_t count = 0;
+            for(size_t i = 0; i < Histogram::buckets; ++i)
+            {
+                uint64_t n = total(s, d.slot + i);
+                if(n == 0)
+                    continue;
+                count += n;
+                if(i + 1 < Histogram::buckets)
+                    append(out, "%s_bucket{%s%sle=\"%llu\"} %llu\n", d.name, label, comma,
+                           (unsigned long long)Histogram::lower_bound(i + 1) - 1,
+                           (unsigned long long)count);
+            }
+            append(out, "%s_bucket{%s%sle=\"+Inf\"} %llu\n", d.name, label, comma,
+                   (unsigned long long)count);
+            append(out, "%s_sum%s%s%s %llu\n", d.name, lbrace, label, rbrace,
+                   (unsigned long long)total(s, d.slot + Histogram::buckets));
+            append(out, "%s_count%s%s%s %llu\n", d.name, lbrace, label, rbrace,
+                   (unsigned long long)count);
+        }
+    }
+    return out;
+}
+
+Counter::Counter(const char * name, const char * help)
+    : slot_(register_metric(name, help, Metrics::counter, 1))
+{
+}
+
+void Counter::add(uint64_t n)
+{
+    shard_add(slot_, n);
+}
+
+uint64_t Counter::value() const
+{
+    return total(slot_);
+}
+
+Gauge::Gauge(const char * name, const char * help)
+    : slot_(register_metric(name, help, Metrics::gauge, 1))
+{
+}
+
+void Gauge::add(int64_t n)
+{
+    // Two's complement, so the per-thread deltas sum up right.
+    shard_add(slot_, static_cast<uint64_t>(n));
+}
+
+int64_t Gauge::value() const
+{
+    return static_cast<int64_t>(total(slot_));
+}
+
+Histogram::Histogram(const char * name, const char * help)
+    : slot_(register_metric(name, help, Metrics::histogram, buckets + 1))
+{
+}
+
+Histogram::Histogram(const char * name, const char * help, const std::string & label)
+    : slot_(register_metric(name, help, Metrics::histogram, buckets + 1, label))
+{
+}
+
+size_t Histogram::bucket(uint64_t value)
+{
+    if(value < linear_buckets)
+        return value;
+    if(value >> max_bits)
+        return buckets - 1;
+    int magnitude = 63 - __builtin_clzll(value);
+    int shift = magnitude - sub_bits;
+    size_t sub = (value >> shift) & ((1 << sub_bits) - 1);
+    return linear_buckets + (magnitude - sub_bits - 1) * (1 << sub_bits) + sub;
+}
+
+uint64_t Histogram::lower_bound(size_t i)
+{
+    if(i < linear_buckets)
+        return i;
+    size_t j = i - linear_buckets;
+    int shift = j / (1 << sub_bits) + 1;
+    uint64_t sub = j % (1 << sub_bits);
+    return ((uint64_t(1) << sub_bits) + sub) << shift;
+}
+
+void Histogram::record(uint64_t value)
+{
+    shard_add(slot_ + bucket(value), 1);
+    shard_add(slot_ + buckets, value);
+}
+
+uint64_t Histogram::count() const
+{
+    State & s = state();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    uint64_t n = 0;
+    for(size_t i = 0; i < buckets; ++i)
+        n += total(s, slot_ + i);
+    return n;
+}
+
+uint64_t Histogram::sum() const
+{
+    return total(slot_ + buckets);
+}
+
+uint64_t Histogram::percentile(double q) const
+{
+    State & s = state();
+    std::lock_guard<std::mutex> lock(s.mutex);
+
+    uint64_t counts[buckets];
+    uint64_t n = 0;
+    for(size_t i = 0; i < buckets; ++i)
+    {
+        counts[i] = total(s, slot_ + i);
+        n += counts[i];
+    }
+    if(n == 0)
+        return 0;
+
+    uint64_t rank = static_cast<uint64_t>(q * (n - 1)) + 1;
+    uint64_t seen = 0;
+    for(size_t i = 0; i + 1 < buckets; ++i)
+    {
+        seen += counts[i];
+        if(seen >= rank)
+            return lower_bound(i + 1) - 1;
+    }
+    return lower_bound(buckets - 1);
+}
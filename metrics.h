@@ -0,0 +1,110 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <cstddef>
+#include <stdint.h>
+#include <string>
+
+#include "noncopyable.h"
+
+// Process wide metrics. Every thread updates its own cache-line-padded shard
+// of plain slots, so recording is a load and a store without a lock or an
+// atomic read-modify-write; readers sum the shards. A reactor runs on one
+// thread, so the per-thread values of the reactor metrics tell the loops
+// apart. Shards of exited threads are folded into one "exited" shard.
+//
+// Metrics are meant to live as long as the process, e.g. as globals. Room is
+// fixed, about 16000 counters or 50 histograms; metrics that no longer fit
+// are left out of render() and share slots, so their values mean nothing.
+// The first one is logged.
+class Metrics
+{
+public:
+    enum Type
+    {
+        counter,
+        gauge,
+        histogram
+    };
+
+    // Name the calling thread's values in render(), e.g. "reactor-1".
+    // Defaults to "thread-<tid>".
+    static void set_thread_name(const std::string & name);
+
+    // All metrics in the Prometheus text format, sorted by name. Counters
+    // and gauges are listed per thread with a thread label, histograms
+    // summed.
+    static std::string render();
+};
+
+class Counter : private Noncopyable
+{
+public:
+    Counter(const char * name, const char * help);
+
+    void add(uint64_t n = 1);
+
+    // Sum over all threads.
+    uint64_t value() const;
+
+private:
+    size_t slot_;
+};
+
+// A value that goes up and down, e.g. open connections. Each thread records
+// its own changes, so add() and sub() may happen on different threads.
+class Gauge : private Noncopyable
+{
+public:
+    Gauge(const char * name, const char * help);
+
+    void add(int64_t n = 1);
+    void sub(int64_t n = 1) { add(-n); }
+
+    int64_t value() const;
+
+private:
+    size_t slot_;
+};
+
+// Log-linear histogram of non-negative integers, e.g. latencies in
+// microseconds. Each power of two is split into eight buckets, so a value is
+// reported with at most 12.5% error; values from 2^40 on share the last
+// bucket.
+class Histogram : private Noncopyable
+{
+public:
+    Histogram(const char * name, const char * help);
+
+    // One of several histograms sharing name, told apart by label, e.g.
+    // type="tcp::Socket".
+    Histogram(const char * name, const char * help, const std::string & label);
+
+    void record(uint64_t value);
+
+    uint64_t count() const;
+    uint64_t sum() const;
+
+    // Upper bound of the bucket holding the q-th quantile, 0 <= q <= 1;
+    // 0 without samples.
+    uint64_t percentile(double q) const;
+
+    enum
+    {
+        sub_bits = 3,
+        linear_buckets = 2 << sub_bits,
+        max_bits = 40,
+        buckets = linear_buckets + (max_bits - sub_bits - 1) * (1 << sub_bits)
+    };
+
+    static size_t bucket(uint64_t value);
+
+    // Smallest value in bucket i.
+    static uint64_t lower_bound(size_t i);
+
+private:
+    // buckets counts followed by the sum.
+    size_t slot_;
+};
+
+#endif // METRICS_H
@@ -1,7 +1,10 @@
 #ifndef OBJECTPOOL_H
 #define OBJECTPOOL_H
 
+#include <cstddef>
+
 #include "noncopyable.h"
+#include "probes.h"
 
 namespace detail {
 
@@ -44,7 +47,9 @@ public:
   // Constructor.
   ObjectPool()
     : live_list_(0),
-      free_list_(0)
+      free_list_(0),
+      free_count_(0),
+      idle_count_(0)
   {
   }
 
@@ -65,10 +70,16 @@ public:
   Object* alloc()
   {
     Object* o = free_list_;
+    int reused = o != 0;
     if (o)
+    {
       free_list_ = ObjectPoolAccess::next(free_list_);
+      if (--free_count_ < idle_count_)
+        idle_count_ = free_count_;
+    }
     else
       o = ObjectPoolAccess::create<Object>();
+    REACTOR_PROBE3(pool_alloc, this, o, reused);
 
     ObjectPoolAccess::next(o) = live_list_;
     ObjectPoolAccess::prev(o) = 0;
@@ -100,6 +111,42 @@ public:
     ObjectPoolAccess::next(o) = free_list_;
     ObjectPoolAccess::prev(o) = 0;
     free_list_ = o;
+    ++free_count_;
+    REACTOR_PROBE2(pool_free, this, o);
+  }
+
+  // Whether alloc() can reuse an object.
+  bool has_free() const
+  {
+    return free_list_ != 0;
+  }
+
+  // Number of objects on the free list.
+  size_t free_size() const
+  {
+    return free_count_;
+  }
+
+  // Destroy the free objects that were not needed since the previous
+  // trim(): as many as the free list never went below. Called periodically
+  // this gives back what a spike left behind while keeping the objects the
+  // current load cycles through. Returns the number destroyed.
+  size_t trim()
+  {
+    size_t n = idle_count_;
+    idle_count_ = free_count_ - n;
+    if (n == 0)
+      return 0;
+
+    // Keep the most recently freed objects, they are warm in the cache.
+    Object** link = &free_list_;
+    for (size_t i = n; i < free_count_; ++i)
+      link = &ObjectPoolAccess::next(*link);
+    Object* list = *link;
+    *link = 0;
+    destroy_list(list);
+    free_count_ -= n;
+    return n;
   }
 
 private:
@@ -119,6 +166,10 @@ private:
 
   // The free list.
   Object* free_list_;
+
+  // Length of the free list, and its minimum since the last trim().
+  size_t free_count_;
+  size_t idle_count_;
 };
 
 } // namespace detail
@@ -0,0 +1,39 @@
+#include "pooltrimmer.h"
+
+#include <malloc.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include "buffer.h"
+#include "metrics.h"
+
+namespace
+{
+
+Counter trimmed("buffer_pool_trimmed_total", "Idle pooled Buffers destroyed by PoolTrimmer.");
+
+}
+
+PoolTrimmer::PoolTrimmer(Reactor & reactor, int interval_seconds)
+    : DeadlineTimer(reactor)
+{
+    set_interval(interval_seconds);
+}
+
+void PoolTrimmer::handle_events(Event event)
+{
+    if(!(event & EPOLLIN))
+        return;
+
+    uint64_t expirations;
+    bool expired = false;
+    while(::read(handle(), &expirations, sizeof(expirations)) == sizeof(expirations))
+        expired = true;
+    if(!expired)
+        return;
+    size_t n = Buffer::trim_pool();
+    trimmed.add(n);
+    // Freed buffers sit in malloc's free lists, give them to the kernel.
+    if(n)
+        ::malloc_trim(0);
+}
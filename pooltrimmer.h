@@ -0,0 +1,20 @@
+#ifndef POOLTRIMMER_H
+#define POOLTRIMMER_H
+
+#include "deadlinetimer.h"
+
+// Gives back pooled memory the reactor's thread no longer needs. Every
+// interval the Buffer pool of the thread running the reactor destroys the
+// buffers that stayed unused since the previous tick and the heap is
+// trimmed, so after a spike the process shrinks to what the current load
+// cycles through.
+class PoolTrimmer : public DeadlineTimer
+{
+public:
+    explicit PoolTrimmer(Reactor & reactor, int interval_seconds = 10);
+
+protected:
+    void handle_events(Event event);
+};
+
+#endif // POOLTRIMMER_H
@@ -0,0 +1,46 @@
+#ifndef PROBES_H
+#define PROBES_H
+
+// USDT static probes, provider "reactor", for perf and bpftrace, e.g.
+//   bpftrace -l 'usdt:./echo_server_tcp:reactor:*'
+// A probe that is not attached is a nop instruction; its arguments should
+// be values already at hand, as they are computed either way. Without
+// <sys/sdt.h> (systemtap-sdt-dev) or with REACTOR_NO_PROBES defined the
+// probes compile to nothing.
+//
+//   wakeup(int events)                       epoll_wait returned
+//   dispatch(void * handler, uint32 events)  before handle_events()
+//   dispatch_done(void * handler)            after handle_events()
+//   register(void * handler, int fd, uint32 events)
+//   deregister(void * handler, int fd)
+//   accept(int listen_fd, int fd)
+//   recv(int fd, size_t bytes, int ec)       completed non-blocking recv
+//   send(int fd, size_t bytes, int ec)       completed non-blocking send
+//   pool_alloc(void * pool, void * object, int reused)
+//   pool_free(void * pool, void * object)
+
+#if !defined(REACTOR_NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define REACTOR_HAVE_PROBES 1
+#endif
+#endif
+
+#ifdef REACTOR_HAVE_PROBES
+#define REACTOR_PROBE1(name, a1) \
+  DTRACE_PROBE1(reactor, name, a1)
+#define REACTOR_PROBE2(name, a1, a2) \
+  DTRACE_PROBE2(reactor, name, a1, a2)
+#define REACTOR_PROBE3(name, a1, a2, a3) \
+  DTRACE_PROBE3(reactor, name, a1, a2, a3)
+#else
+// sizeof keeps variables that only feed probes from being unused.
+#define REACTOR_PROBE1(name, a1) \
+  do { (void)sizeof(a1); } while (0)
+#define REACTOR_PROBE2(name, a1, a2) \
+  do { (void)sizeof(a1); (void)sizeof(a2); } while (0)
+#define REACTOR_PROBE3(name, a1, a2, a3) \
+  do { (void)sizeof(a1); (void)sizeof(a2); (void)sizeof(a3); } while (0)
+#endif
+
+#endif // PROBES_H
@@ -85,6 +85,29 @@ public:
     }
   }
 
+  // Remove an Element from anywhere in the queue, finding it by walking
+  // from the front. For error paths; the queue is singly linked.
+  void erase(Element* e)
+  {
+    if (e == front_)
+    {
+      pop();
+      return;
+    }
+    for (Element* prev = front_; prev; prev = QueueAccess::next(prev))
+    {
+      if (QueueAccess::next(prev) == e)
+      {
+        QueueAccess::next(prev, QueueAccess::next(e));
+        if (back_ == e)
+          back_ = prev;
+        QueueAccess::next(e, static_cast<Element*>(0));
+        --size_;
+        return;
+      }
+    }
+  }
+
   // Push an Element on to the back of the queue.
   void push(Element* h)
   {
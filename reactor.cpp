@@ -1,17 +1,86 @@
 #include "reactor.h"
 
 #include <sys/epoll.h>
+#include <map>
+#include <mutex>
+#include <string>
+#include <typeinfo>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/syscall.h>
 #include <assert.h>
 #include <errno.h>
 
 #include "systemexception.h"
+#include "metrics.h"
+#include "loglimiter.h"
+#include "tscclock.h"
+#include "demangle.h"
+#include "probes.h"
+#include "trace.h"
+
+namespace
+{
+
+Counter wakeups("reactor_wakeups_total", "Returns from epoll_wait.");
+Counter events("reactor_events_total", "Events dispatched to handlers.");
+Histogram batch_size("reactor_batch_events", "Events per epoll_wait; batches at the limit of 128 mean the loop is saturated.");
+Histogram dispatch_lag("reactor_dispatch_lag_us", "Microseconds from epoll_wait returning to an event being dispatched.");
+Counter slow_handlers("reactor_slow_handlers_total", "handle_events() calls over the slow handler threshold.");
+
+}
+
+// Timing of one handler type, shared by all reactors. Lives as long as the
+// process, like the histogram in it.
+class HandlerProfile
+{
+public:
+    static HandlerProfile * get(const std::type_info & type)
+    {
+        static std::mutex mutex;
+        static std::map<std::string, HandlerProfile *> profiles;
+
+        std::string name = detail::demangle(type);
+        std::lock_guard<std::mutex> lock(mutex);
+        HandlerProfile *& p = profiles[name];
+        if(!p)
+            p = new HandlerProfile(name);
+        return p;
+    }
+
+    std::string name;
+    Histogram latency;
+
+private:
+    HandlerProfile(const std::string & type)
+        : name(type)
+        , latency("reactor_handler_us", "Microseconds spent in handle_events() per handler type.",
+                  "type=\"" + type + "\"")
+    {
+    }
+};
 
 Reactor::Reactor()
     : stopped_(false)
     , epoll_fd_(do_epoll_create())
+    , num_events_(0)
+    , current_event_(0)
+    , dispatching_(false)
+    , now_(MonoClock::coarse_now())
+    , profiling_(false)
+    , slow_handler_ticks_(0)
+    , recorder_(0)
+    , heartbeat_(0)
+    , idle_(true)
+    , current_type_(0)
+    , current_fd_(-1)
+    , running_(false)
+    , thread_()
+    , thread_id_(0)
 {
+    // Calibrate the TSC now rather than in the first handler that times
+    // something.
+    detail::TscClock::ticks_per_us();
 }
 
 Reactor::~Reactor()
@@ -22,15 +91,84 @@ Reactor::~Reactor()
 
 void Reactor::run()
 {
+    thread_ = pthread_self();
+    thread_id_ = ::syscall(SYS_gettid);
+    running_.store(true, std::memory_order_release);
+
     while(!stopped_)
     {
-        epoll_event events[2048];
-        int num = epoll_wait(epoll_fd_, events, 128, -1);
-        for(int i = 0; i < num; ++i)
+        idle_.store(true, std::memory_order_relaxed);
+        num_events_ = epoll_wait(epoll_fd_, events_, max_events, -1);
+        idle_.store(false, std::memory_order_relaxed);
+        now_ = MonoClock::coarse_now();
+        REACTOR_PROBE1(wakeup, num_events_);
+        TraceRecorder::activate(recorder_);
+        if(num_events_ > 0)
+        {
+            wakeups.add();
+            events.add(num_events_);
+            batch_size.record(num_events_);
+        }
+        uint64_t batch_start = profiling_ ? detail::TscClock::now() : 0;
+        dispatching_ = true;
+        for(current_event_ = 0; current_event_ < num_events_; ++current_event_)
         {
-            EventHandler * h = static_cast<EventHandler *>(events[i].data.ptr);
-            h->handle_events(events[i].events);
+            EventHandler * h = static_cast<EventHandler *>(events_[current_event_].data.ptr);
+            if(!h)
+                continue;
+            current_fd_.store(h->handle(), std::memory_order_relaxed);
+            current_type_.store(&typeid(*h), std::memory_order_relaxed);
+            heartbeat_.store(heartbeat_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            REACTOR_PROBE2(dispatch, h, events_[current_event_].events);
+            if(recorder_)
+                recorder_->record(TraceRecorder::event, h->handle(), events_[current_event_].events);
+            if(profiling_)
+                dispatch_profiled(h, events_[current_event_].events, batch_start);
+            else
+                h->handle_events(events_[current_event_].events);
+            REACTOR_PROBE1(dispatch_done, h);
         }
+        current_type_.store(0, std::memory_order_relaxed);
+        current_fd_.store(-1, std::memory_order_relaxed);
+        num_events_ = 0;
+        dispatching_ = false;
+        if(!deferred_.empty())
+            release_deferred();
+    }
+
+    // So the reactor can be run again.
+    stopped_ = false;
+    TraceRecorder::activate(0);
+    running_.store(false, std::memory_order_release);
+}
+
+void Reactor::set_profiling(bool on, uint64_t slow_handler_us)
+{
+    // Calibrates the clock now rather than in the first dispatch.
+    slow_handler_ticks_ = detail::TscClock::from_us(slow_handler_us);
+    profiling_ = on;
+}
+
+void Reactor::dispatch_profiled(EventHandler * handler, Event events, uint64_t batch_start)
+{
+    HandlerProfile *& profile = profiles_[std::type_index(typeid(*handler))];
+    if(!profile)
+        profile = HandlerProfile::get(typeid(*handler));
+
+    // The handler may delete itself, so take what the report needs first.
+    int fd = handler->handle();
+
+    uint64_t start = detail::TscClock::now();
+    dispatch_lag.record(detail::TscClock::to_us(start - batch_start));
+    handler->handle_events(events);
+    uint64_t ticks = detail::TscClock::now() - start;
+
+    profile->latency.record(detail::TscClock::to_us(ticks));
+    if(ticks > slow_handler_ticks_)
+    {
+        slow_handlers.add();
+        LOG_LIMITED(Logger::warn_level, 1, 10) << "slow handler " << profile->name << " fd " << fd
+                                                << " took " << detail::TscClock::to_us(ticks) << "us";
     }
 }
 
@@ -41,7 +179,24 @@ int Reactor::register_handle(EventHandler * handler, Event event)
     epoll_event ev = {0,{0}};
     ev.events = event;
     ev.data.ptr = handler;
-    int ret = epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, handler->handle(), &ev);
+    int fd = handler->handle();
+    int ret = epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev);
+    if(ret == -1)
+        return errno;
+    REACTOR_PROBE3(register, handler, fd, event);
+    if(recorder_)
+        recorder_->record(TraceRecorder::open, fd, event);
+    return ret;
+}
+
+int Reactor::modify_handle(EventHandler * handler, Event event)
+{
+    assert(handler != 0);
+
+    epoll_event ev = {0,{0}};
+    ev.events = event;
+    ev.data.ptr = handler;
+    int ret = epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, handler->handle(), &ev);
     if(ret == -1)
         return errno;
     return ret;
@@ -52,7 +207,36 @@ void Reactor::deregister_handle(EventHandler * handler)
     assert(handler != 0);
 
     epoll_event event = {0,{0}};
-    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, handler->handle(), &event);
+    int fd = handler->handle();
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, &event);
+    REACTOR_PROBE2(deregister, handler, fd);
+    if(recorder_)
+        recorder_->record(TraceRecorder::close, fd, 0);
+
+    for(int i = current_event_ + 1; i < num_events_; ++i)
+    {
+        if(events_[i].data.ptr == handler)
+            events_[i].data.ptr = 0;
+    }
+}
+
+void Reactor::defer_release(EventHandler * handler, HandlerReleaser & releaser)
+{
+    if(!dispatching_)
+    {
+        releaser.release(handler);
+        return;
+    }
+    Deferred d = { handler, &releaser };
+    deferred_.push_back(d);
+}
+
+void Reactor::release_deferred()
+{
+    // Outside the batch, so anything deferred meanwhile is released at once.
+    for(size_t i = 0; i < deferred_.size(); ++i)
+        deferred_[i].releaser->release(deferred_[i].handler);
+    deferred_.clear();
 }
 
 int Reactor::do_epoll_create()
@@ -1,6 +1,15 @@
 #pragma once
 
+#include <atomic>
 #include <stdint.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <typeindex>
+#include <typeinfo>
+#include <unordered_map>
+#include <vector>
+
+#include "clock.h"
 
 typedef uint32_t Event;
 typedef int Handle;
@@ -15,6 +24,21 @@ public:
     }
 };
 
+class HandlerProfile;
+class TraceRecorder;
+
+// Takes back handlers passed to Reactor::defer_release(), e.g. a pool.
+class HandlerReleaser
+{
+public:
+    virtual void release(EventHandler * handler) = 0;
+
+protected:
+    ~HandlerReleaser()
+    {
+    }
+};
+
 class Reactor
 {
 public:
@@ -22,21 +46,110 @@ public:
     ~Reactor();
 
     void run();
+    // Make run() return after the current batch. run() may be called again.
+    void stop() { stopped_ = true; }
     int register_handle(EventHandler * handler, Event event);
+
+    // Change the interest set of a registered handler. With EPOLLET this also
+    // re-arms the handle, reporting readiness that is still pending.
+    int modify_handle(EventHandler * handler, Event event);
+
+    // Also drops events of the current batch that are still pending for the
+    // handler, so it may be destroyed right after.
     void deregister_handle(EventHandler *handler);
 
+    // Hand handler to releaser once the current batch has been dispatched,
+    // or right away outside a batch. Until then handler stays valid for
+    // code that still holds it, including the handler's own frames. Call on
+    // the loop thread, with handler already deregistered.
+    void defer_release(EventHandler * handler, HandlerReleaser & releaser);
+
+    // Coarse monotonic time sampled once per loop iteration, when epoll_wait
+    // returned, so handlers share one reading instead of each asking the
+    // kernel. Lags by up to the clock's granularity plus the time spent in
+    // the batch; use MonoClock::now() or detail::TscClock for intervals
+    // within a handler.
+    MonoTime now() const { return now_; }
+
+    // Time every handle_events() call into a histogram per handler type,
+    // record how long events wait in their batch before being dispatched,
+    // and warn about handlers that take longer than slow_handler_us. Off
+    // by default, when dispatching costs one extra branch.
+    void set_profiling(bool on, uint64_t slow_handler_us = 10000);
+
+    // Record registrations and dispatched events, and through socket_ops the
+    // bytes moved and descriptors closed on the loop thread, until set back
+    // to null. Handles registered from other threads while running are not
+    // recorded reliably. The recorder must outlive the recording.
+    void set_recorder(TraceRecorder * recorder) { recorder_ = recorder; }
+
+    // Progress of run() as seen from other threads, e.g. a Watchdog. The
+    // heartbeat advances with every dispatched event; a loop that is not
+    // idle in epoll_wait and whose heartbeat stands still is stuck in the
+    // handler of type current_type() on current_fd(), or outside any
+    // handler when the type is null. The handler itself is not published:
+    // it may be destroyed at any time, so another thread must not touch it.
+    uint64_t heartbeat() const { return heartbeat_.load(std::memory_order_relaxed); }
+    bool is_idle() const { return idle_.load(std::memory_order_relaxed); }
+    const std::type_info * current_type() const { return current_type_.load(std::memory_order_relaxed); }
+    int current_fd() const { return current_fd_.load(std::memory_order_relaxed); }
+
+    // Thread running run(), valid once is_running().
+    bool is_running() const { return running_.load(std::memory_order_acquire); }
+    pthread_t thread() const { return thread_; }
+    int thread_id() const { return thread_id_; }
+
 private:
     friend class Proactor;
 
     enum { epoll_size = 20000 };
 
+    enum { max_events = 128 };
+
     int do_epoll_create();
 
     int do_timerfd_create();
 
+    void dispatch_profiled(EventHandler * handler, Event events, uint64_t batch_start);
+
+    void release_deferred();
+
     bool stopped_;
 
     int epoll_fd_;
+
+    // The batch being dispatched by run().
+    epoll_event events_[max_events];
+    int num_events_;
+    int current_event_;
+    bool dispatching_;
+    MonoTime now_;
+
+    struct Deferred
+    {
+        EventHandler * handler;
+        HandlerReleaser * releaser;
+    };
+
+    // Released after the batch; keeps its capacity, so deferring does not
+    // allocate once warmed up.
+    std::vector<Deferred> deferred_;
+
+    bool profiling_;
+    uint64_t slow_handler_ticks_;
+    std::unordered_map<std::type_index, HandlerProfile *> profiles_;
+
+    TraceRecorder * recorder_;
+
+    // Written by the loop thread only.
+    std::atomic<uint64_t> heartbeat_;
+    std::atomic<bool> idle_;
+    std::atomic<const std::type_info *> current_type_;
+    std::atomic<int> current_fd_;
+
+    std::atomic<bool> running_;
+    pthread_t thread_;
+    int thread_id_;
 };
 
 
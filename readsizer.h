@@ -0,0 +1,75 @@
+#ifndef READSIZER_H
+#define READSIZER_H
+
+#include <cstddef>
+
+namespace detail
+{
+
+// Picks how many bytes to ask the next read for, from an exponentially
+// smoothed history of earlier reads, so small messages do not pay for large
+// buffers and bulk transfers do not pay for many small reads.
+class ReadSizer
+{
+public:
+  enum Mode
+  {
+    // Size from the read history, costs nothing extra.
+    history,
+
+    // Size from FIONREAD, exact but one more syscall per read.
+    available
+  };
+
+  ReadSizer(size_t min_size, size_t max_size)
+    : mode_(history)
+    , min_size_(min_size)
+    , max_size_(max_size)
+    , average_(min_size)
+  {
+  }
+
+  Mode mode() const
+  {
+    return mode_;
+  }
+
+  void set_mode(Mode mode)
+  {
+    mode_ = mode;
+  }
+
+  // Bytes to request next; twice the average so a typical read comes back
+  // short, which tells the caller the socket is drained.
+  size_t next() const
+  {
+    return clamp(2 * average_);
+  }
+
+  // Bytes to request after a read filled the whole request.
+  size_t grow(size_t last) const
+  {
+    return clamp(2 * last);
+  }
+
+  size_t clamp(size_t size) const
+  {
+    return size < min_size_ ? min_size_ : size > max_size_ ? max_size_ : size;
+  }
+
+  // Record the size of a completed read.
+  void update(size_t bytes)
+  {
+    average_ = (7 * average_ + bytes) / 8;
+  }
+
+private:
+  Mode mode_;
+  size_t min_size_;
+  size_t max_size_;
+  size_t average_;
+};
+
+} // namespace detail
+
+#endif // READSIZER_H
@@ -0,0 +1,50 @@
+#ifndef SIGPIPEGUARD_H
+#define SIGPIPEGUARD_H
+
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "noncopyable.h"
+
+namespace detail
+{
+
+// Blocks SIGPIPE on the calling thread while in scope. sendfile() and
+// splice() take no MSG_NOSIGNAL, so writing to a socket whose peer is gone
+// raises the signal, whose default action kills the process; blocked, the
+// call only fails with EPIPE. Call consume() after an EPIPE so the pending
+// signal is not delivered once the old mask is back.
+class SigpipeGuard : private Noncopyable
+{
+public:
+    SigpipeGuard()
+    {
+        sigemptyset(&pipe_);
+        sigaddset(&pipe_, SIGPIPE);
+        pthread_sigmask(SIG_BLOCK, &pipe_, &old_);
+    }
+
+    ~SigpipeGuard()
+    {
+        pthread_sigmask(SIG_SETMASK, &old_, 0);
+    }
+
+    // Discard the SIGPIPE raised in scope. Left alone when the thread had
+    // it blocked before, as it would have stayed pending without the guard.
+    void consume()
+    {
+        if(sigismember(&old_, SIGPIPE))
+            return;
+        timespec zero = { 0, 0 };
+        sigtimedwait(&pipe_, 0, &zero);
+    }
+
+private:
+    sigset_t pipe_;
+    sigset_t old_;
+};
+
+} // namespace detail
+
+#endif // SIGPIPEGUARD_H
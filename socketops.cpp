@@ -6,6 +6,8 @@
 #include <poll.h>
 
 #include "error.h"
+#include "probes.h"
+#include "trace.h"
 
 namespace socket_ops
 {
@@ -132,6 +134,8 @@ int close(socket_type s, bool destruction, error_code_type& ec)
   int result = 0;
   if (s != invalid_socket)
   {
+    TraceRecorder::note(TraceRecorder::close, s, 0);
+
     // We don't want the destructor to block, so set the socket to linger in
     // the background. If the user doesn't like this behaviour then they need
     // to explicitly close the socket.
@@ -441,6 +445,8 @@ bool non_blocking_recv(socket_type s,
     if (is_stream && bytes == 0)
     {
         ec = detail::error::eof;
+        REACTOR_PROBE3(recv, s, 0, ec);
+        TraceRecorder::note(TraceRecorder::recv, s, 0);
         return true;
     }
 
@@ -462,6 +468,9 @@ bool non_blocking_recv(socket_type s,
     else
         bytes_transferred = 0;
 
+    REACTOR_PROBE3(recv, s, bytes_transferred, ec);
+    if (bytes_transferred)
+      TraceRecorder::note(TraceRecorder::recv, s, bytes_transferred);
     return true;
   }
 }
@@ -719,10 +728,31 @@ bool non_blocking_send(socket_type s,
     else
       bytes_transferred = 0;
 
+    REACTOR_PROBE3(send, s, bytes_transferred, ec);
+    if (bytes_transferred)
+      TraceRecorder::note(TraceRecorder::send, s, bytes_transferred);
     return true;
   }
 }
 
+signed_size_type sendto(socket_type s, const buf* bufs, size_t count,
+    int flags, const socket_addr_type* addr, std::size_t addrlen,
+    error_code_type& ec)
+{
+  clear_last_error();
+
+  msghdr msg = msghdr();
+  init_msghdr_msg_name(msg.msg_name, addr);
+  msg.msg_namelen = static_cast<int>(addrlen);
+  msg.msg_iov = const_cast<buf*>(bufs);
+  msg.msg_iovlen = static_cast<int>(count);
+  flags |= MSG_NOSIGNAL;
+  signed_size_type result = error_wrapper(::sendmsg(s, &msg, flags), ec);
+  if (result >= 0)
+    ec = 0;
+  return result;
+}
+
 socket_type socket(int af, int type, int protocol,
     error_code_type& ec)
 {
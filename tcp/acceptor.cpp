@@ -1,17 +1,46 @@
 #include "acceptor.h"
 
 #include <sys/epoll.h>
+#include <sys/socket.h>
+#include <linux/filter.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <vector>
+#include <algorithm>
 
+#include "error.h"
 #include "socketops.h"
 #include "systemexception.h"
+#include "metrics.h"
+#include "probes.h"
+#include "admission.h"
 
 namespace tcp
 {
-    
+
+namespace
+{
+
+Counter accepted("tcp_accepted_total", "Connections accepted.");
+Counter accept_drops("tcp_accept_dropped_total", "Connections dropped for lack of descriptors or shed by the application.");
+Counter accept_backoffs("tcp_accept_backoffs_total", "Times an Acceptor stopped accepting for a while after accept failed.");
+
+}
+
 Acceptor::Acceptor(Reactor & reactor, const Endpoint & ep)
     : reactor_(&reactor)
     , endpoint_(ep)
     , handle_(do_acceptor_create())
+    , spare_fd_(::open("/dev/null", O_RDONLY | O_CLOEXEC))
+    , max_accepts_(default_max_accepts)
+    , paused_(false)
+    , dropped_(0)
+    , retry_timer_(this)
+    , backoff_(MonoClock::milliseconds(min_backoff_ms))
+    , backing_off_(false)
+    , admission_(0)
+    , filtered_(false)
     , closed_(false)
 {
     Event event = EPOLLIN | EPOLLERR | EPOLLET;
@@ -32,32 +61,268 @@ void Acceptor::destroy()
         socket_ops::close(handle_, true, ec);
         handle_ = socket_ops::invalid_socket;
     }
+
+    if(spare_fd_ != -1)
+    {
+        ::close(spare_fd_);
+        spare_fd_ = -1;
+    }
+}
+
+void Acceptor::pause()
+{
+    if(paused_)
+        return;
+    paused_ = true;
+    reactor_->modify_handle(this, EPOLLERR | EPOLLET);
+}
+
+void Acceptor::resume()
+{
+    if(!paused_)
+        return;
+    paused_ = false;
+    if(!backing_off_)
+        reactor_->modify_handle(this, EPOLLIN | EPOLLERR | EPOLLET);
+}
+
+void Acceptor::handle_events(Event event)
+{
+    if(paused_ || backing_off_ || !(event & EPOLLIN))
+        return;
+
+    for(int i = 0; i < max_accepts_ && !paused_; ++i)
+    {
+        socklen_t len = peer_.capacity();
+        int sock = ::accept4(handle_, peer_.data(), &len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if(sock != -1)
+        {
+            backoff_ = MonoClock::milliseconds(min_backoff_ms);
+            peer_.resize(len);
+            accepted.add();
+            REACTOR_PROBE2(accept, handle_, sock);
+            if(filtered_)
+                ::setsockopt(sock, SOL_SOCKET, SO_DETACH_FILTER, 0, 0);
+            if(admission_ && !admission_->admit(peer_, reactor_->now()))
+                reject(sock);
+            else
+                handle_accept(sock);
+            continue;
+        }
+
+        switch(errno)
+        {
+        case EAGAIN:
+#if EWOULDBLOCK != EAGAIN
+        case EWOULDBLOCK:
+#endif
+            // The backlog is drained, wait for the next edge.
+            if(admission_)
+                update_filter();
+            return;
+        case EINTR:
+        case ECONNABORTED:
+        case EPROTO:
+            break;
+        case EMFILE:
+        case ENFILE:
+            if(drop_connection())
+                break;
+            back_off();
+            return;
+        default:
+            // Out of kernel memory or similar; the backlog stays readable,
+            // so re-arming would report it again right away.
+            back_off();
+            return;
+        }
+    }
+
+    if(admission_)
+        update_filter();
+
+    // Connections may still be pending; re-arm so the edge fires again once
+    // the other ready handlers had their turn.
+    if(!paused_)
+        reactor_->modify_handle(this, EPOLLIN | EPOLLERR | EPOLLET);
+}
+
+bool Acceptor::drop_connection()
+{
+    if(spare_fd_ == -1)
+    {
+        // Try to reserve one again now that descriptors may have freed up.
+        spare_fd_ = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+        return false;
+    }
+
+    ++dropped_;
+    accept_drops.add();
+    ::close(spare_fd_);
+    int sock = ::accept(handle_, 0, 0);
+    if(sock != -1)
+        ::close(sock);
+    spare_fd_ = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+    return true;
+}
+
+void Acceptor::back_off()
+{
+    if(admission_)
+        update_filter();
+
+    backing_off_ = true;
+    accept_backoffs.add();
+    reactor_->modify_handle(this, EPOLLERR | EPOLLET);
+    retry_timer_.set_timeout(backoff_);
+    backoff_ = std::min<MonoTime>(2 * backoff_, MonoClock::milliseconds(max_backoff_ms));
+}
+
+void Acceptor::retry()
+{
+    backing_off_ = false;
+    // Re-arming reports the connections that queued meanwhile.
+    if(!paused_)
+        reactor_->modify_handle(this, EPOLLIN | EPOLLERR | EPOLLET);
+}
+
+Acceptor::RetryTimer::RetryTimer(Acceptor * acceptor)
+    : DeadlineTimer(acceptor->get_reactor())
+    , acceptor_(acceptor)
+{
+}
+
+void Acceptor::RetryTimer::handle_events(Event event)
+{
+    uint64_t expirations;
+    if(::read(handle(), &expirations, sizeof(expirations)) == sizeof(expirations))
+        acceptor_->retry();
+}
+
+void Acceptor::set_admission(Admission * admission)
+{
+    admission_ = admission;
+    update_filter();
+}
+
+void Acceptor::update_filter()
+{
+    if(handle_ == socket_ops::invalid_socket)
+        return;
+    if(!admission_)
+    {
+        if(filtered_ && ::setsockopt(handle_, SOL_SOCKET, SO_DETACH_FILTER, 0, 0) == 0)
+            filtered_ = false;
+        return;
+    }
+    if(!admission_->update_blocked(reactor_->now()))
+        return;
+
+    const std::vector<uint32_t> & blocked = admission_->blocked();
+    if(blocked.empty())
+    {
+        if(::setsockopt(handle_, SOL_SOCKET, SO_DETACH_FILTER, 0, 0) == 0 || errno == ENOENT)
+            filtered_ = false;
+        return;
+    }
+
+    // Drop IPv4 packets from a blocked source, accept everything else. The
+    // filter of a listener sees SYNs before a connection is queued.
+    std::vector<sock_filter> code;
+    code.reserve(6 + 2 * blocked.size());
+    sock_filter version[] =
+    {
+        BPF_STMT(BPF_LD | BPF_B | BPF_ABS, uint32_t(SKF_NET_OFF)),
+        BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 4),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 4, 1, 0),
+        BPF_STMT(BPF_RET | BPF_K, 0xffffffff),
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS, uint32_t(SKF_NET_OFF + 12)),
+    };
+    code.insert(code.end(), version, version + sizeof(version) / sizeof(version[0]));
+    for(uint32_t addr : blocked)
+    {
+        sock_filter drop[] =
+        {
+            BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, addr, 0, 1),
+            BPF_STMT(BPF_RET | BPF_K, 0),
+        };
+        code.insert(code.end(), drop, drop + 2);
+    }
+    code.push_back(BPF_STMT(BPF_RET | BPF_K, 0xffffffff));
+
+    sock_fprog prog = { (unsigned short)code.size(), &code[0] };
+    if(::setsockopt(handle_, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) == 0)
+        filtered_ = true;
+}
+
+void Acceptor::reject(int socket)
+{
+    // Reset rather than leave a TIME_WAIT socket behind.
+    linger l = { 1, 0 };
+    ::setsockopt(socket, SOL_SOCKET, SO_LINGER, &l, sizeof(l));
+    ::close(socket);
+}
+
+void Acceptor::shed(int socket)
+{
+    ++dropped_;
+    accept_drops.add();
+    ::close(socket);
+}
+
+bool Acceptor::is_stale_local_path()
+{
+    if(!endpoint_.is_local_path())
+        return false;
+
+    // Non-blocking, so a live listener with a full backlog cannot hold up
+    // the constructor; it answers EAGAIN, which counts as alive.
+    int ec;
+    int fd = socket_ops::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, ec);
+    if(fd == socket_ops::invalid_socket)
+        return false;
+    socket_ops::connect(fd, endpoint_.data(), endpoint_.size(), ec);
+    int ignored;
+    socket_ops::close(fd, true, ignored);
+    return ec == detail::error::connection_refused;
 }
 
 int Acceptor::do_acceptor_create()
 {
     int ec;
-    int fd = socket_ops::socket(AF_INET, SOCK_STREAM, 0, ec);
+    int fd = socket_ops::socket(endpoint_.family(), SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, ec);
     throw_error(ec, "bind: create socket");
 
-    int opt=1;
-    socket_ops::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt), ec);
-    throw_error(ec, "bind: set reuseaddr");
-
-    socket_ops::set_non_blocking(fd, true, ec);
-    throw_error(ec, "bind: set nonblocking");
-
-    struct sockaddr_in addr;
-    int result = endpoint_.get_sockaddr(addr);
-    if(!result)
-        throw_error(-1, "bind: bad addr");
+    const char * what = "bind: set reuseaddr";
+    if(endpoint_.family() != AF_UNIX)
+    {
+        int opt=1;
+        socket_ops::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt), ec);
+    }
 
-    socket_ops::bind(fd, (sockaddr *)&addr, sizeof(addr), ec);
-    throw_error(ec, "bind: bind");
+    if(!ec)
+    {
+        what = "bind: bind";
+        socket_ops::bind(fd, endpoint_.data(), endpoint_.size(), ec);
+        if(ec == detail::error::address_in_use && is_stale_local_path())
+        {
+            ::unlink(endpoint_.to_string().c_str());
+            socket_ops::bind(fd, endpoint_.data(), endpoint_.size(), ec);
+        }
+    }
 
-    socket_ops::listen(fd, 100, ec);
-    throw_error(ec, "bind: listen");
+    if(!ec)
+    {
+        what = "bind: listen";
+        socket_ops::listen(fd, SOMAXCONN, ec);
+    }
 
+    if(ec)
+    {
+        int ignored;
+        socket_ops::close(fd, true, ignored);
+        throw_error(ec, what);
+    }
     return fd;
 }
 
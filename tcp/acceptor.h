@@ -3,10 +3,13 @@
 
 #include "reactor.h"
 #include "endpoint.h"
+#include "deadlinetimer.h"
 
 namespace tcp
 {
 
+class Admission;
+
 class Acceptor : public EventHandler
 {
 public:
@@ -15,16 +18,107 @@ public:
     virtual int handle() { return handle_; }
     Reactor & get_reactor() { return *reactor_; }
 
+    // Limit the connections accepted per wakeup so a burst cannot starve the
+    // other handlers; the rest is picked up on the next loop iteration.
+    void set_max_accepts(int n) { max_accepts_ = n; }
+
+    // Stop accepting, leaving new connections in the listen backlog, e.g.
+    // to shed load. resume() picks up connections that queued meanwhile,
+    // unless the acceptor is backing off from a failed accept.
+    void pause();
+    void resume();
+    bool is_paused() { return paused_; }
+
+    // Connections dropped because the process ran out of descriptors or
+    // handle_accept() shed them.
+    uint64_t dropped() { return dropped_; }
+
+    // Turn away connections admission does not admit, closing them with a
+    // reset before handle_accept(); 0 admits everything. admission must
+    // outlive the acceptor or be unset first.
+    void set_admission(Admission * admission);
+
+    // Bring the listener's socket filter in line with the sources
+    // admission blocks, lifting expired blocks. Done after every batch of
+    // accepts; call it periodically as well, since blocked sources alone
+    // do not wake the acceptor.
+    void update_filter();
+
+    // Address of the connection being handed to handle_accept().
+    const Endpoint & peer() const { return peer_; }
+
+protected:
+    // Accept pending connections and hand them to handle_accept().
+    virtual void handle_events(Event event);
+
+    // Called with each accepted socket, already non-blocking and close-on-exec.
+    virtual void handle_accept(int socket) = 0;
+
+    // Close an accepted socket that is not wanted, e.g. for lack of memory,
+    // counting it as dropped.
+    void shed(int socket);
+
 private:
+    // Ends a back off.
+    class RetryTimer : public DeadlineTimer
+    {
+    public:
+        explicit RetryTimer(Acceptor * acceptor);
+
+        virtual void handle_events(Event event);
+
+        Acceptor * acceptor_;
+    };
+
     void destroy();
 
     int do_acceptor_create();
 
+    // Whether the Unix socket file at endpoint_ is left over from a process
+    // that is gone, so it may be replaced.
+    bool is_stale_local_path();
+
+    // Shed one pending connection using the reserved descriptor when
+    // accepting failed with EMFILE or ENFILE. Returns false when there is
+    // no descriptor to spare.
+    bool drop_connection();
+
+    // Stop watching the listener after accept failed in a way retrying
+    // right away would not fix, e.g. the kernel is out of memory, and try
+    // again after backoff_, which doubles with every failure in a row.
+    void back_off();
+    void retry();
+
+    // Close a connection admission turned away.
+    void reject(int socket);
+
+    enum { default_max_accepts = 64 };
+
+    enum { min_backoff_ms = 10, max_backoff_ms = 1000 };
+
     Reactor * reactor_;
     Endpoint endpoint_;
 
     int handle_;
 
+    // Descriptor held in reserve for drop_connection().
+    int spare_fd_;
+
+    int max_accepts_;
+    bool paused_;
+    uint64_t dropped_;
+
+    RetryTimer retry_timer_;
+    MonoTime backoff_;
+    bool backing_off_;
+
+    Admission * admission_;
+    Endpoint peer_;
+
+    // Whether a socket filter is attached to the listener, which accepted
+    // sockets inherit.
+    bool filtered_;
+
     bool closed_;
 };
 
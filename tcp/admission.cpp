@@ -0,0 +1,296 @@
+#include "admission.h"
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "metrics.h"
+
+namespace tcp
+{
+
+namespace
+{
+
+Counter rejected_total("tcp_admission_rejected_total", "Connections turned away by admission control.");
+Gauge blocked_sources("tcp_admission_blocked_sources", "Sources whose SYNs are dropped by a listener filter.");
+
+const Admission::Key ipv4 = Admission::Key(1) << 32;
+const Admission::Key ipv6 = Admission::Key(1) << 63;
+
+MonoTime interval(double rate)
+{
+    return rate > 0 ? MonoTime(MonoClock::ns_per_s / rate) : 0;
+}
+
+uint64_t mix(uint64_t x)
+{
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+}
+
+Admission::Limits::Limits()
+    : rate(0)
+    , burst(0)
+    , source_rate(0)
+    , source_burst(0)
+    , source_connections(0)
+    , block_after(0)
+    , block_seconds(60)
+{
+}
+
+Admission::Key Admission::key(const Endpoint & peer)
+{
+    if(peer.family() == AF_INET)
+    {
+        const sockaddr_in * in = reinterpret_cast<const sockaddr_in *>(peer.data());
+        return ipv4 | ntohl(in->sin_addr.s_addr);
+    }
+    if(peer.family() == AF_INET6)
+    {
+        const sockaddr_in6 * in6 = reinterpret_cast<const sockaddr_in6 *>(peer.data());
+        const uint8_t * a = in6->sin6_addr.s6_addr;
+        if(IN6_IS_ADDR_V4MAPPED(&in6->sin6_addr))
+            return ipv4 | (uint32_t(a[12]) << 24 | uint32_t(a[13]) << 16 | uint32_t(a[14]) << 8 | a[15]);
+        // The /64 prefix, which one host usually has to itself.
+        uint64_t prefix = 0;
+        for(int i = 0; i < 8; ++i)
+            prefix = prefix << 8 | a[i];
+        return ipv6 | (prefix >> 1);
+    }
+    return 0;
+}
+
+Admission::Admission(const Limits & limits, size_t sources)
+    : limits_(limits)
+    , interval_(interval(limits.rate))
+    , window_(interval_ * (limits.burst ? limits.burst : 1))
+    , source_interval_(interval(limits.source_rate))
+    , source_window_(source_interval_ * (limits.source_burst ? limits.source_burst : 1))
+    , next_(0)
+    , mask_(0)
+    , newest_(none)
+    , oldest_(none)
+    , blocked_changed_(false)
+    , rejected_(0)
+{
+    size_t size = 16;
+    while(size < 2 * sources)
+        size <<= 1;
+    sources_.reserve(sources ? sources : 1);
+    index_.assign(size, 0);
+    mask_ = size - 1;
+}
+
+bool Admission::take_token(MonoTime & next, MonoTime interval, MonoTime window, MonoTime now)
+{
+    if(interval == 0)
+        return true;
+    MonoTime updated = (next > now ? next : now) + interval;
+    if(updated - now > window)
+        return false;
+    next = updated;
+    return true;
+}
+
+bool Admission::admit(const Endpoint & peer, MonoTime now)
+{
+    Key k = key(peer);
+    Source * s = 0;
+    if(k && (source_interval_ || limits_.source_connections))
+    {
+        s = find(k);
+        if(!s)
+            s = insert(k);
+        if(!s)
+        {
+            ++rejected_;
+            rejected_total.add();
+            return false;
+        }
+        if(!s->connections)
+            touch(uint32_t(s - &sources_[0]));
+
+        if((limits_.source_connections && s->connections >= limits_.source_connections)
+           || !take_token(s->next, source_interval_, source_window_, now))
+        {
+            if(limits_.block_after && ++s->rejections >= limits_.block_after)
+                block(k, now);
+            ++rejected_;
+            rejected_total.add();
+            return false;
+        }
+    }
+
+    if(!take_token(next_, interval_, window_, now))
+    {
+        ++rejected_;
+        rejected_total.add();
+        return false;
+    }
+
+    if(s)
+    {
+        // Out of the recently seen list while connected, so not forgotten.
+        if(s->connections++ == 0)
+            unlink(uint32_t(s - &sources_[0]));
+        s->rejections = 0;
+    }
+    return true;
+}
+
+void Admission::release(Key key)
+{
+    if(!key)
+        return;
+    Source * s = find(key);
+    if(s && s->connections && --s->connections == 0)
+        touch(uint32_t(s - &sources_[0]));
+}
+
+bool Admission::update_blocked(MonoTime now)
+{
+    for(size_t i = 0; i < blocked_.size();)
+    {
+        if(blocked_until_[i] > now)
+        {
+            ++i;
+            continue;
+        }
+        blocked_[i] = blocked_.back();
+        blocked_until_[i] = blocked_until_.back();
+        blocked_.pop_back();
+        blocked_until_.pop_back();
+        blocked_sources.sub();
+        blocked_changed_ = true;
+    }
+
+    bool changed = blocked_changed_;
+    blocked_changed_ = false;
+    return changed;
+}
+
+void Admission::block(Key key, MonoTime now)
+{
+    if((key & ~Key(0xffffffff)) != ipv4 || blocked_.size() >= max_blocked)
+        return;
+    uint32_t addr = uint32_t(key);
+    for(size_t i = 0; i < blocked_.size(); ++i)
+    {
+        if(blocked_[i] == addr)
+            return;
+    }
+    blocked_.push_back(addr);
+    blocked_until_.push_back(now + MonoClock::seconds(limits_.block_seconds));
+    blocked_sources.add();
+    blocked_changed_ = true;
+}
+
+size_t Admission::home(Key key) const
+{
+    return mix(key) & mask_;
+}
+
+size_t Admission::position(Key key) const
+{
+    size_t pos = home(key);
+    while(index_[pos] && sources_[index_[pos] - 1].key != key)
+        pos = (pos + 1) & mask_;
+    return pos;
+}
+
+Admission::Source * Admission::find(Key key)
+{
+    uint32_t i = index_[position(key)];
+    return i ? &sources_[i - 1] : 0;
+}
+
+Admission::Source * Admission::insert(Key key)
+{
+    uint32_t i;
+    if(sources_.size() < sources_.capacity())
+    {
+        i = uint32_t(sources_.size());
+        sources_.push_back(Source());
+    }
+    else if(oldest_ == none)
+    {
+        return 0;
+    }
+    else
+    {
+        // Forget the least recently seen source without connections.
+        i = oldest_;
+        unlink(i);
+        unindex(position(sources_[i].key));
+    }
+
+    Source & s = sources_[i];
+    s.key = key;
+    s.next = 0;
+    s.connections = 0;
+    s.rejections = 0;
+    s.newer = s.older = none;
+    index_[position(key)] = i + 1;
+    return &s;
+}
+
+void Admission::unindex(size_t pos)
+{
+    for(;;)
+    {
+        index_[pos] = 0;
+        size_t next = pos;
+        for(;;)
+        {
+            next = (next + 1) & mask_;
+            if(!index_[next])
+                return;
+            // An entry moves into the gap unless its home lies between the
+            // gap and where it is.
+            size_t h = home(sources_[index_[next] - 1].key);
+            if(((next - h) & mask_) >= ((next - pos) & mask_))
+                break;
+        }
+        index_[pos] = index_[next];
+        pos = next;
+    }
+}
+
+void Admission::touch(uint32_t i)
+{
+    if(newest_ == i)
+        return;
+    Source & s = sources_[i];
+    if(s.newer != none || s.older != none || oldest_ == i)
+        unlink(i);
+    s.newer = none;
+    s.older = newest_;
+    if(newest_ != none)
+        sources_[newest_].newer = i;
+    newest_ = i;
+    if(oldest_ == none)
+        oldest_ = i;
+}
+
+void Admission::unlink(uint32_t i)
+{
+    Source & s = sources_[i];
+    if(s.newer != none)
+        sources_[s.newer].older = s.older;
+    else
+        newest_ = s.older;
+    if(s.older != none)
+        sources_[s.older].newer = s.newer;
+    else
+        oldest_ = s.newer;
+    s.newer = s.older = none;
+}
+
+}// namespace tcp
@@ -0,0 +1,149 @@
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+#include <cstddef>
+#include <stdint.h>
+#include <vector>
+
+#include "endpoint.h"
+#include "clock.h"
+#include "noncopyable.h"
+
+namespace tcp
+{
+
+// Admission control for an Acceptor, see Acceptor::set_admission(). Limits
+// how fast connections are accepted overall and per source, and how many
+// connections one source may hold. A source is an IPv4 address or an IPv6
+// /64; connections from Unix sockets only count toward the overall rate.
+//
+// Sources live in a fixed size table that forgets the least recently seen
+// one without connections when a new source arrives and the table is full,
+// so memory stays bounded during a storm from many addresses. A forgotten
+// source starts over with a full bucket. Sources holding connections are
+// kept so their release() calls find them; when all of them do, new sources
+// are turned away. Size the table above the number of sources expected to
+// be connected at once.
+//
+// IPv4 sources that keep being rejected can be blocked in the kernel for a
+// while: a socket filter on the listener then drops their SYNs before they
+// are queued or accepted. Blocks are lifted by Acceptor::update_filter().
+//
+// Belongs to the thread running the acceptor's reactor.
+class Admission : private Noncopyable
+{
+public:
+    struct Limits
+    {
+        // Everything unlimited.
+        Limits();
+
+        // Accepted connections per second overall, in bursts of burst.
+        double rate;
+        unsigned burst;
+
+        // The same per source.
+        double source_rate;
+        unsigned source_burst;
+
+        // Connections one source may hold.
+        unsigned source_connections;
+
+        // Block a source for block_seconds once block_after of its
+        // connections in a row were rejected by the source limits.
+        unsigned block_after;
+        int block_seconds;
+    };
+
+    // Identifies a source, 0 for none.
+    typedef uint64_t Key;
+
+    static Key key(const Endpoint & peer);
+
+    explicit Admission(const Limits & limits, size_t sources = 4096);
+
+    // Whether to keep a connection from peer arriving at now, e.g.
+    // Reactor::now(). An admitted connection counts toward its source until
+    // release(key(peer)).
+    bool admit(const Endpoint & peer, MonoTime now);
+
+    // A connection admit() let in has closed.
+    void release(Key key);
+
+    // Connections turned away so far.
+    uint64_t rejected() const { return rejected_; }
+
+    enum { max_blocked = 1024 };
+
+    // Blocked IPv4 sources in host byte order, at most max_blocked.
+    const std::vector<uint32_t> & blocked() const { return blocked_; }
+
+    // Lift blocks expired by now. Returns whether blocked() changed since
+    // the last call.
+    bool update_blocked(MonoTime now);
+
+private:
+    struct Source
+    {
+        Key key;
+
+        // Token bucket schedule, as in LogLimiter.
+        MonoTime next;
+
+        uint32_t connections;
+        uint32_t rejections;
+
+        // Neighbours in the recently seen list, which holds the sources
+        // without connections.
+        uint32_t newer;
+        uint32_t older;
+    };
+
+    enum : uint32_t { none = 0xffffffff };
+
+    static bool take_token(MonoTime & next, MonoTime interval, MonoTime window, MonoTime now);
+
+    Source * find(Key key);
+
+    // Add key, forgetting the oldest source without connections if the
+    // table is full. Returns 0 when every source holds connections.
+    Source * insert(Key key);
+
+    // Position of key in index_.
+    size_t position(Key key) const;
+    size_t home(Key key) const;
+
+    // Remove the index_ entry at pos, moving later entries of its probe
+    // sequence up.
+    void unindex(size_t pos);
+
+    void touch(uint32_t i);
+    void unlink(uint32_t i);
+
+    void block(Key key, MonoTime now);
+
+    Limits limits_;
+    MonoTime interval_;
+    MonoTime window_;
+    MonoTime source_interval_;
+    MonoTime source_window_;
+    MonoTime next_;
+
+    // Sources, and an open addressing table of their index + 1 with linear
+    // probing, twice as large.
+    std::vector<Source> sources_;
+    std::vector<uint32_t> index_;
+    size_t mask_;
+    uint32_t newest_;
+    uint32_t oldest_;
+
+    std::vector<uint32_t> blocked_;
+    std::vector<MonoTime> blocked_until_;
+    bool blocked_changed_;
+
+    uint64_t rejected_;
+};
+
+}// namespace tcp
+
+#endif // ADMISSION_H
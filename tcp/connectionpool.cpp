@@ -0,0 +1,184 @@
+#include "connectionpool.h"
+
+#include <sys/socket.h>
+#include <errno.h>
+
+#include "connector.h"
+#include "socketops.h"
+#include "metrics.h"
+
+namespace tcp
+{
+
+namespace
+{
+
+Gauge idle_connections("pool_idle_connections", "Connections parked in a ConnectionPool.");
+Counter reused("pool_reused_total", "Connections handed out from the idle list.");
+Counter connects("pool_connects_total", "New connections started by a ConnectionPool.");
+Counter connect_failures("pool_connect_failures_total", "Pool connects that failed or timed out.");
+
+}
+
+class ConnectionPool::PendingConnect : public Connector
+{
+public:
+    PendingConnect(ConnectionPool * pool, const Handler & handler)
+        : Connector(*pool->reactor_)
+        , pool_(pool)
+        , handler_(handler)
+    {
+    }
+
+protected:
+    void handle_connect(int socket, int ec)
+    {
+        pool_->complete(this, socket, ec);
+    }
+
+private:
+    friend class ConnectionPool;
+
+    ConnectionPool * pool_;
+    Handler handler_;
+};
+
+ConnectionPool::ConnectionPool(Reactor & reactor, int connect_timeout,
+                               int idle_timeout, size_t max_idle)
+    : reactor_(&reactor)
+    , connect_timeout_(connect_timeout)
+    , idle_timeout_(idle_timeout)
+    , max_idle_(max_idle)
+{
+}
+
+ConnectionPool::~ConnectionPool()
+{
+    for(auto p : pending_)
+        delete p;
+
+    int ec;
+    for(auto & i : idle_)
+    {
+        for(auto & c : i.second)
+            socket_ops::close(c.socket, true, ec);
+        idle_connections.sub(i.second.size());
+    }
+}
+
+void ConnectionPool::get(const Endpoint & ep, const Handler & handler)
+{
+    auto i = idle_.find(ep.to_string());
+    if(i != idle_.end())
+    {
+        std::vector<Idle> & idle = i->second;
+        while(!idle.empty())
+        {
+            int socket = idle.back().socket;
+            idle.pop_back();
+            idle_connections.sub();
+            if(is_reusable(socket))
+            {
+                if(idle.empty())
+                    idle_.erase(i);
+                reused.add();
+                handler(socket, 0);
+                return;
+            }
+
+            int ec;
+            socket_ops::close(socket, true, ec);
+        }
+        idle_.erase(i);
+    }
+
+    connects.add();
+    PendingConnect * p = new PendingConnect(this, handler);
+    pending_.insert(p);
+    p->connect(ep, connect_timeout_);
+}
+
+void ConnectionPool::put(const Endpoint & ep, int socket)
+{
+    if(max_idle_ == 0)
+    {
+        int ec;
+        socket_ops::close(socket, true, ec);
+        return;
+    }
+
+    std::vector<Idle> & idle = idle_[ep.to_string()];
+    if(idle.size() >= max_idle_)
+    {
+        int ec;
+        socket_ops::close(socket, true, ec);
+        return;
+    }
+
+    Idle c = { socket, reactor_->now() };
+    idle.push_back(c);
+    idle_connections.add();
+}
+
+void ConnectionPool::check_timeout()
+{
+    MonoTime now = reactor_->now();
+
+    int ec;
+    for(auto i = idle_.begin(); i != idle_.end();)
+    {
+        std::vector<Idle> & idle = i->second;
+        size_t kept = 0;
+        for(size_t j = 0; j < idle.size(); ++j)
+        {
+            if(idle[j].since + MonoClock::seconds(idle_timeout_) > now)
+                idle[kept++] = idle[j];
+            else
+                socket_ops::close(idle[j].socket, true, ec);
+        }
+        idle_connections.sub(idle.size() - kept);
+        idle.resize(kept);
+
+        // Endpoints without idle connections are dropped, so keys do not
+        // pile up.
+        if(kept)
+            ++i;
+        else
+            i = idle_.erase(i);
+    }
+
+    // Completing a connect removes it from pending_.
+    std::vector<PendingConnect *> pending(pending_.begin(), pending_.end());
+    for(auto p : pending)
+        p->check_timeout(now);
+}
+
+size_t ConnectionPool::idle_count() const
+{
+    size_t count = 0;
+    for(auto & i : idle_)
+        count += i.second.size();
+    return count;
+}
+
+bool ConnectionPool::is_reusable(int socket)
+{
+    char c;
+    ssize_t n = ::recv(socket, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    return n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+void ConnectionPool::complete(PendingConnect * p, int socket, int ec)
+{
+    Handler handler;
+    handler.swap(p->handler_);
+    pending_.erase(p);
+    delete p;
+
+    if(ec)
+        connect_failures.add();
+
+    handler(socket, ec);
+}
+
+}// namespace tcp
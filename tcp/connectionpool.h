@@ -0,0 +1,76 @@
+#ifndef CONNECTIONPOOL_H
+#define CONNECTIONPOOL_H
+
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "reactor.h"
+#include "endpoint.h"
+#include "noncopyable.h"
+
+namespace tcp
+{
+
+// Keeps idle upstream connections per endpoint and hands them out again,
+// falling back to a Connector when none is available.
+class ConnectionPool : private Noncopyable
+{
+public:
+    // Receives the connected socket and 0, or -1 and an error code.
+    typedef std::function<void(int socket, int ec)> Handler;
+
+    ConnectionPool(Reactor & reactor, int connect_timeout = 5,
+                   int idle_timeout = 60, size_t max_idle = 16);
+    ~ConnectionPool();
+
+    // Get a connection to ep: the most recently returned idle one that is
+    // still healthy, or a new one. The handler owns the socket on success and
+    // may run before get() returns.
+    void get(const Endpoint & ep, const Handler & handler);
+
+    // Return a connection to ep for reuse. The socket must not be registered
+    // with the reactor, see tcp::Socket::release(). Beyond max_idle per
+    // endpoint it is closed instead.
+    void put(const Endpoint & ep, int socket);
+
+    // Close idle connections past idle_timeout and fail connects past
+    // connect_timeout. Call periodically, e.g. from a DeadlineTimer.
+    void check_timeout();
+
+    size_t idle_count() const;
+
+    // Endpoints with idle connections.
+    size_t idle_endpoints() const { return idle_.size(); }
+    size_t connecting_count() const { return pending_.size(); }
+
+private:
+    class PendingConnect;
+    friend class PendingConnect;
+
+    struct Idle
+    {
+        int socket;
+        MonoTime since;
+    };
+
+    // Whether an idle socket was neither closed by the peer nor received
+    // unsolicited data.
+    static bool is_reusable(int socket);
+
+    void complete(PendingConnect * p, int socket, int ec);
+
+    Reactor * reactor_;
+    int connect_timeout_;
+    int idle_timeout_;
+    size_t max_idle_;
+
+    std::unordered_map<std::string, std::vector<Idle> > idle_;
+    std::unordered_set<PendingConnect *> pending_;
+};
+
+}// namespace tcp
+
+#endif // CONNECTIONPOOL_H
@@ -0,0 +1,102 @@
+#include "connector.h"
+
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include "error.h"
+#include "socketops.h"
+
+namespace tcp
+{
+
+Connector::Connector(Reactor & reactor)
+    : reactor_(&reactor)
+    , socket_(-1)
+    , deadline_(0)
+{
+}
+
+Connector::~Connector()
+{
+    cancel();
+}
+
+int Connector::connect(const Endpoint & ep, int timeout_seconds)
+{
+    if(socket_ != -1)
+        return detail::error::already_started;
+
+    int ec;
+    int fd = socket_ops::socket(ep.family(), SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, ec);
+    if(fd == socket_ops::invalid_socket)
+    {
+        handle_connect(-1, ec);
+        return 0;
+    }
+
+    socket_ = fd;
+    deadline_ = reactor_->now() + MonoClock::seconds(timeout_seconds);
+
+    socket_ops::connect(fd, ep.data(), ep.size(), ec);
+    if(ec != detail::error::in_progress)
+    {
+        complete(ec);
+        return 0;
+    }
+
+    ec = reactor_->register_handle(this, EPOLLOUT | EPOLLERR | EPOLLET);
+    if(ec)
+        complete(ec);
+    return 0;
+}
+
+void Connector::cancel()
+{
+    if(socket_ != -1)
+    {
+        reactor_->deregister_handle(this);
+        int ec;
+        socket_ops::close(socket_, true, ec);
+        socket_ = -1;
+    }
+}
+
+bool Connector::check_timeout(MonoTime now)
+{
+    if(socket_ == -1 || now < deadline_)
+        return false;
+
+    complete(detail::error::timed_out);
+    return true;
+}
+
+void Connector::handle_events(Event event)
+{
+    if(socket_ == -1 || !(event & (EPOLLOUT | EPOLLERR | EPOLLHUP)))
+        return;
+
+    int err = 0;
+    size_t len = sizeof(err);
+    int ec;
+    if(socket_ops::getsockopt(socket_, 0, SOL_SOCKET, SO_ERROR, &err, &len, ec) != 0)
+        err = ec;
+    complete(err);
+}
+
+void Connector::complete(int ec)
+{
+    reactor_->deregister_handle(this);
+
+    int fd = socket_;
+    socket_ = -1;
+    if(ec)
+    {
+        int ignored;
+        socket_ops::close(fd, true, ignored);
+        fd = -1;
+    }
+
+    handle_connect(fd, ec);
+}
+
+}// namespace tcp
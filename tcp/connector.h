@@ -0,0 +1,54 @@
+#ifndef CONNECTOR_H
+#define CONNECTOR_H
+
+#include "reactor.h"
+#include "clock.h"
+#include "endpoint.h"
+
+namespace tcp
+{
+
+// Active side of the acceptor-connector pattern: starts a non-blocking
+// connect and completes it when the socket turns writable.
+class Connector : public EventHandler
+{
+public:
+    Connector(Reactor & reactor);
+    ~Connector();
+    virtual int handle() { return socket_; }
+    Reactor & get_reactor() { return *reactor_; }
+
+    // Start connecting to ep. The result is reported through
+    // handle_connect(), which runs before connect() returns when the
+    // connection is established or refused immediately. Returns an error
+    // code if a connect is already in progress.
+    int connect(const Endpoint & ep, int timeout_seconds);
+
+    bool is_connecting() { return socket_ != -1; }
+
+    // Abandon the connect in progress without calling handle_connect().
+    void cancel();
+
+    // Fail the connect with timed_out once its deadline passed. Call
+    // periodically, e.g. from a DeadlineTimer.
+    bool check_timeout(MonoTime now);
+
+protected:
+    virtual void handle_events(Event event);
+
+    // Called once per connect(). On success ec is 0 and the handler owns
+    // socket, which is non-blocking and no longer registered; on failure
+    // socket is -1.
+    virtual void handle_connect(int socket, int ec) = 0;
+
+private:
+    void complete(int ec);
+
+    Reactor * reactor_;
+    int socket_;
+    MonoTime deadline_;
+};
+
+}// namespace tcp
+
+#endif // CONNECTOR_H
@@ -1,23 +1,14 @@
-#ifndef ENDPOINT_H
-#define ENDPOINT_H
+#ifndef TCP_ENDPOINT_H
+#define TCP_ENDPOINT_H
 
-#include <string>
-
-class sockaddr_in;
+#include "genericendpoint.h"
 
 namespace tcp
 {
-    
-class Endpoint
-{
-public:
-    Endpoint(const std::string & ip, unsigned short port);
-    bool get_sockaddr(sockaddr_in& addr) const;
-private:
-    std::string ip_;
-    unsigned short port_;
-};
+
+// IPv4, IPv6 or Unix stream socket address.
+typedef GenericEndpoint Endpoint;
 
 }// namespace tcp
 
-#endif // ENDPOINT_H
+#endif // TCP_ENDPOINT_H
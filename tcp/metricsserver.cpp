@@ -0,0 +1,146 @@
+#include "metricsserver.h"
+
+#include <sys/epoll.h>
+#include <string>
+#include <vector>
+#include <cstring>
+
+#include "socket.h"
+#include "error.h"
+#include "metrics.h"
+
+namespace tcp
+{
+
+class MetricsServer::Connection : public Socket
+{
+public:
+    Connection(MetricsServer * server, int socket)
+        : Socket(server->get_reactor(), socket, true)
+        , server_(server)
+        , since_(server->get_reactor().now())
+        , responded_(false)
+    {
+    }
+
+    bool is_expired(MonoTime now, int timeout_seconds)
+    {
+        return since_ + MonoClock::seconds(timeout_seconds) <= now;
+    }
+
+protected:
+    void handle_events(Event event)
+    {
+        if(event & EPOLLIN)
+        {
+            // The request itself is not looked at; it is read to be answered
+            // and so the close does not reset the connection.
+            detail::Queue<Buffer> bufs;
+            size_t bytes;
+            int ec = receive(bufs, bytes, event);
+            if(!responded_ && bytes)
+                ec = respond();
+            if(ec && (!responded_ || ec != detail::error::eof))
+            {
+                server_->remove(this);
+                return;
+            }
+        }
+
+        if(event & EPOLLOUT)
+        {
+            if(flush())
+            {
+                server_->remove(this);
+                return;
+            }
+        }
+
+        if(event & (EPOLLERR | EPOLLHUP))
+        {
+            server_->remove(this);
+            return;
+        }
+
+        if(responded_ && send_queue_size() == 0)
+            server_->remove(this);
+    }
+
+private:
+    int respond()
+    {
+        responded_ = true;
+
+        std::string body = Metrics::render();
+        char header[128];
+        int n = std::snprintf(header, sizeof(header),
+                              "HTTP/1.0 200 OK\r\n"
+                              "Content-Type: text/plain; version=0.0.4\r\n"
+                              "Content-Length: %zu\r\n"
+                              "\r\n", body.size());
+
+        detail::Queue<Buffer> bufs;
+        append(bufs, header, n);
+        append(bufs, body.data(), body.size());
+        return send(bufs);
+    }
+
+    static void append(detail::Queue<Buffer> & bufs, const char * data, size_t size)
+    {
+        while(size)
+        {
+            Buffer * b = Buffer::alloc();
+            b->size = std::min<size_t>(size, Buffer::max_size);
+            std::memcpy(b->data, data, b->size);
+            bufs.push(b);
+            data += b->size;
+            size -= b->size;
+        }
+    }
+
+    MetricsServer * server_;
+    MonoTime since_;
+    bool responded_;
+};
+
+MetricsServer::MetricsServer(Reactor & reactor, const Endpoint & ep)
+    : Acceptor(reactor, ep)
+{
+}
+
+MetricsServer::~MetricsServer()
+{
+    for(auto c : connections_)
+        delete c;
+}
+
+void MetricsServer::check_timeout(MonoTime now, int timeout_seconds)
+{
+    for(auto i = connections_.begin(); i != connections_.end();)
+    {
+        if((*i)->is_expired(now, timeout_seconds))
+        {
+            // Other events of this batch may still name the connection.
+            get_reactor().deregister_handle(*i);
+            delete *i;
+            i = connections_.erase(i);
+        }
+        else
+        {
+            ++i;
+        }
+    }
+}
+
+void MetricsServer::handle_accept(int socket)
+{
+    connections_.insert(new Connection(this, socket));
+}
+
+void MetricsServer::remove(Connection * c)
+{
+    connections_.erase(c);
+    delete c;
+}
+
+}// namespace tcp
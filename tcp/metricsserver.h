@@ -0,0 +1,40 @@
+#ifndef METRICSSERVER_H
+#define METRICSSERVER_H
+
+#include <unordered_set>
+
+#include "acceptor.h"
+
+namespace tcp
+{
+
+// Serves Metrics::render() from the reactor it runs on. Any request on a
+// connection, e.g. an HTTP GET from curl or a Prometheus scrape, is answered
+// with an HTTP/1.0 response and the connection is closed, so it also works
+// on a Unix socket:
+//   curl --unix-socket /tmp/metrics.sock http://localhost/metrics
+class MetricsServer : public Acceptor
+{
+public:
+    MetricsServer(Reactor & reactor, const Endpoint & ep);
+    ~MetricsServer();
+
+    // Close connections that did not finish within timeout_seconds. Call
+    // periodically, e.g. from a DeadlineTimer.
+    void check_timeout(MonoTime now, int timeout_seconds = 10);
+
+protected:
+    virtual void handle_accept(int socket);
+
+private:
+    class Connection;
+    friend class Connection;
+
+    void remove(Connection * c);
+
+    std::unordered_set<Connection *> connections_;
+};
+
+}// namespace tcp
+
+#endif // METRICSSERVER_H
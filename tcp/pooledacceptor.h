@@ -0,0 +1,43 @@
+#ifndef POOLEDACCEPTOR_H
+#define POOLEDACCEPTOR_H
+
+#include "acceptor.h"
+#include "handlerpool.h"
+
+namespace tcp
+{
+
+// Acceptor constructing a Socket for each accepted connection in a
+// HandlerPool. Sockets close themselves with pool().destroy(this), which
+// returns them to the pool once the current batch is dispatched.
+template <typename Socket, size_t SlabSize = 256>
+class PooledAcceptor : public Acceptor
+{
+public:
+    PooledAcceptor(Reactor & reactor, const Endpoint & ep)
+        : Acceptor(reactor, ep)
+        , pool_(reactor)
+    {
+    }
+
+    HandlerPool<Socket, SlabSize> & pool() { return pool_; }
+
+protected:
+    // Construct the Socket for an accepted connection with pool().create().
+    // Returning 0, e.g. because the pool is over its memory budget, sheds
+    // the connection.
+    virtual Socket * create_socket(int socket) = 0;
+
+    void handle_accept(int socket)
+    {
+        if(!create_socket(socket))
+            shed(socket);
+    }
+
+private:
+    HandlerPool<Socket, SlabSize> pool_;
+};
+
+}// namespace tcp
+
+#endif // POOLEDACCEPTOR_H
@@ -0,0 +1,212 @@
+#include "relay.h"
+
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "socketops.h"
+#include "systemexception.h"
+#include "sigpipeguard.h"
+
+namespace tcp
+{
+
+Relay::Side::Side(Relay * relay, int socket)
+    : relay_(relay)
+    , socket_(socket)
+    , readable_(true)
+    , writable_(true)
+{
+}
+
+void Relay::Side::handle_events(Event events)
+{
+    relay_->handle_events(this, events);
+}
+
+Relay::Relay(Reactor & reactor, int socket1, int socket2)
+    : reactor_(&reactor)
+    , side1_(this, socket1)
+    , side2_(this, socket2)
+    , closed_(false)
+{
+    directions_[0] = Direction{&side1_, &side2_, {-1, -1}, 0, false, false, 0};
+    directions_[1] = Direction{&side2_, &side1_, {-1, -1}, 0, false, false, 0};
+
+    // The destructor does not run when this throws, so undo what was set
+    // up before any failure first.
+    int ec;
+    const char * what = "relay: set nonblocking";
+    socket_ops::set_non_blocking(socket1, true, ec);
+    if(!ec)
+        socket_ops::set_non_blocking(socket2, true, ec);
+
+    for(Direction & d : directions_)
+    {
+        if(!ec && ::pipe2(d.pipe, O_NONBLOCK | O_CLOEXEC) == -1)
+        {
+            ec = errno;
+            what = "relay: pipe";
+        }
+    }
+
+    Event event = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLERR | EPOLLET;
+    if(!ec)
+    {
+        what = "relay: register socket";
+        ec = reactor_->register_handle(&side1_, event);
+        if(!ec)
+        {
+            ec = reactor_->register_handle(&side2_, event);
+            if(ec)
+                reactor_->deregister_handle(&side1_);
+        }
+    }
+
+    if(ec)
+    {
+        close_pipes();
+        throw_error(ec, what);
+    }
+}
+
+Relay::~Relay()
+{
+    if(!closed_)
+    {
+        reactor_->deregister_handle(&side1_);
+        reactor_->deregister_handle(&side2_);
+    }
+
+    int ec;
+    socket_ops::close(side1_.socket_, true, ec);
+    socket_ops::close(side2_.socket_, true, ec);
+    close_pipes();
+}
+
+void Relay::close_pipes()
+{
+    for(Direction & d : directions_)
+    {
+        if(d.pipe[0] != -1)
+        {
+            ::close(d.pipe[0]);
+            ::close(d.pipe[1]);
+            d.pipe[0] = d.pipe[1] = -1;
+        }
+    }
+}
+
+void Relay::handle_events(Side * side, Event events)
+{
+    if(closed_)
+        return;
+
+    if(events & EPOLLERR)
+    {
+        int err = 0;
+        size_t len = sizeof(err);
+        int ec;
+        socket_ops::getsockopt(side->socket_, 0, SOL_SOCKET, SO_ERROR, &err, &len, ec);
+        close(err ? err : ec);
+        return;
+    }
+
+    if(events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP))
+        side->readable_ = true;
+    if(events & EPOLLOUT)
+        side->writable_ = true;
+
+    // splice() into a socket takes no MSG_NOSIGNAL.
+    detail::SigpipeGuard guard;
+    for(Direction & d : directions_)
+    {
+        int ec = pump(d);
+        if(ec)
+        {
+            if(ec == EPIPE)
+                guard.consume();
+            close(ec);
+            return;
+        }
+    }
+
+    if(directions_[0].shutdown && directions_[1].shutdown)
+        close(0);
+}
+
+int Relay::pump(Direction & d)
+{
+    for(;;)
+    {
+        if(d.pipe_size)
+        {
+            if(!d.to->writable_)
+                return 0;
+
+            ssize_t n = ::splice(d.pipe[0], 0, d.to->socket_, 0, d.pipe_size,
+                                 SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if(n > 0)
+            {
+                d.pipe_size -= n;
+                d.bytes += n;
+                continue;
+            }
+            if(n < 0 && errno == EINTR)
+                continue;
+            if(n < 0 && errno != EAGAIN)
+                return errno;
+            d.to->writable_ = false;
+            return 0;
+        }
+
+        if(d.eof)
+        {
+            if(!d.shutdown)
+            {
+                int ec;
+                socket_ops::shutdown(d.to->socket_, SHUT_WR, ec);
+                d.shutdown = true;
+            }
+            return 0;
+        }
+
+        if(!d.from->readable_)
+            return 0;
+
+        // The pipe is empty here, so EAGAIN can only come from the source.
+        ssize_t n = ::splice(d.from->socket_, 0, d.pipe[1], 0, pipe_capacity,
+                             SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if(n > 0)
+        {
+            d.pipe_size += n;
+            continue;
+        }
+        if(n == 0)
+        {
+            d.eof = true;
+            continue;
+        }
+        if(errno == EINTR)
+            continue;
+        if(errno != EAGAIN)
+            return errno;
+        d.from->readable_ = false;
+        return 0;
+    }
+}
+
+void Relay::close(int ec)
+{
+    if(closed_)
+        return;
+
+    closed_ = true;
+    reactor_->deregister_handle(&side1_);
+    reactor_->deregister_handle(&side2_);
+    handle_close(ec);
+}
+
+}// namespace tcp
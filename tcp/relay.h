@@ -0,0 +1,82 @@
+#ifndef RELAY_H
+#define RELAY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "reactor.h"
+#include "noncopyable.h"
+
+namespace tcp
+{
+
+// Forwards data between two connected sockets in both directions with
+// splice(), moving pages through a pipe per direction instead of copying
+// them through user space. A side that hits EOF is half-closed on the peer.
+class Relay : private Noncopyable
+{
+public:
+    // Takes ownership of both sockets, unless it throws.
+    Relay(Reactor & reactor, int socket1, int socket2);
+    virtual ~Relay();
+
+    bool is_closed() const { return closed_; }
+
+    // Bytes delivered from socket1 to socket2 and the other way round.
+    uint64_t bytes_forwarded() const { return directions_[0].bytes; }
+    uint64_t bytes_returned() const { return directions_[1].bytes; }
+
+protected:
+    // Called once both directions finished (ec 0) or either side failed.
+    // The relay may be deleted from here.
+    virtual void handle_close(int ec) { }
+
+private:
+    class Side : public EventHandler
+    {
+    public:
+        Side(Relay * relay, int socket);
+
+        virtual Handle handle() { return socket_; }
+        virtual void handle_events(Event events);
+
+        Relay * relay_;
+        int socket_;
+        bool readable_;
+        bool writable_;
+    };
+
+    struct Direction
+    {
+        Side * from;
+        Side * to;
+        int pipe[2];
+        size_t pipe_size;
+        bool eof;
+        bool shutdown;
+        uint64_t bytes;
+    };
+
+    enum { pipe_capacity = 1 << 16, };
+
+    void handle_events(Side * side, Event events);
+
+    // Move data until the source drains or the destination blocks. While the
+    // pipe holds data the source is not read, so a slow receiver throttles
+    // the sender through TCP flow control. Returns an error code.
+    int pump(Direction & d);
+
+    void close(int ec);
+
+    void close_pipes();
+
+    Reactor * reactor_;
+    Side side1_;
+    Side side2_;
+    Direction directions_[2];
+    bool closed_;
+};
+
+}// namespace tcp
+
+#endif // RELAY_H
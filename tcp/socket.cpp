@@ -1,30 +1,78 @@
 #include "socket.h"
 
 #include <sys/epoll.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <algorithm>
+#include <atomic>
 
+#include "error.h"
 #include "socketops.h"
 #include "systemexception.h"
+#include "metrics.h"
+#include "memory.h"
+#include "sigpipeguard.h"
 
 namespace tcp
 {
-    
-Socket::Socket(Reactor & reactor, int socket)
+
+namespace
+{
+
+// Largest chunk handed to sendfile or splice in one call.
+const size_t max_chunk = 1 << 20;
+
+const Event events = EPOLLIN | EPOLLOUT | EPOLLPRI | EPOLLRDHUP | EPOLLERR | EPOLLET;
+
+// Shared by the sockets of all reactor threads.
+std::atomic<size_t> send_queued(0);
+std::atomic<size_t> send_limit(0);
+
+Gauge sockets("tcp_sockets", "Open tcp::Socket objects.");
+Counter bytes_received("tcp_received_bytes_total", "Bytes read by tcp::Socket.");
+Counter bytes_sent("tcp_sent_bytes_total", "Bytes written by tcp::Socket, including sendfile and splice.");
+Counter read_pauses("tcp_read_pauses_total", "Times a tcp::Socket stopped reading for a full send queue.");
+Gauge paused_sockets("tcp_paused_sockets", "tcp::Sockets not reading for a full send queue.");
+
+}
+
+Socket::Socket(Reactor & reactor, int socket, bool non_blocking)
     : reactor_(&reactor)
     , socket_(socket)
     , closed_(false)
+    , send_offset_(0)
+    , send_bytes_(0)
+    , high_watermark_(Memory::connection_budget())
+    , low_watermark_(high_watermark_ / 4)
+    , paused_(false)
+    , pipe_size_(0)
+    , source_(this)
+    , read_sizer_(Buffer::max_size, max_iov * Buffer::max_size)
 {
+    pipe_[0] = pipe_[1] = -1;
+
     int ec;
-    socket_ops::set_non_blocking(socket_, true, ec);
-    throw_error(ec, "set noblocking");
+    if(!non_blocking)
+    {
+        socket_ops::set_non_blocking(socket_, true, ec);
+        throw_error(ec, "set noblocking");
+    }
 
-    Event event = EPOLLIN | EPOLLOUT | EPOLLPRI | EPOLLERR | EPOLLET;
-    ec = reactor_->register_handle(this, event);
+    ec = reactor_->register_handle(this, events);
     throw_error(ec, "register socket");
+    sockets.add();
 }
 
 Socket::~Socket()
 {
     close();
+    send_queued.fetch_sub(send_bytes_, std::memory_order_relaxed);
+    if(paused_)
+        paused_sockets.sub();
+    sockets.sub();
 }
 
 void Socket::close()
@@ -35,6 +83,425 @@ void Socket::close()
         socket_ops::close(socket_, true, ec);
         closed_ = true;
     }
+    unwatch_source();
+    close_pipe();
+}
+
+void Socket::close_pipe()
+{
+    if(pipe_[0] != -1)
+    {
+        ::close(pipe_[0]);
+        ::close(pipe_[1]);
+        pipe_[0] = pipe_[1] = -1;
+        pipe_size_ = 0;
+    }
+}
+
+Endpoint Socket::remote_endpoint()
+{
+    Endpoint ep;
+    socklen_t size = ep.capacity();
+    if(::getpeername(socket_, ep.data(), &size) == 0)
+        ep.resize(size);
+    return ep;
+}
+
+int Socket::release()
+{
+    if(closed_ || !send_buffers_.empty())
+        return -1;
+
+    reactor_->deregister_handle(this);
+    closed_ = true;
+    close_pipe();
+    return socket_;
+}
+
+int Socket::receive(detail::Queue<Buffer> & bufs, size_t & bytes_transferred, Event event)
+{
+    bytes_transferred = 0;
+
+    int ec;
+    size_t want;
+    if(read_sizer_.mode() == detail::ReadSizer::available)
+    {
+        // One byte more than queued, so reading it all is a short read.
+        want = socket_ops::available(socket_, ec) + 1;
+    }
+    else
+    {
+        want = read_sizer_.next();
+    }
+
+    for(;;)
+    {
+        Buffer * b[max_iov];
+        socket_ops::buf iov[max_iov];
+        size_t count = std::min<size_t>(max_iov, (want + Buffer::max_size - 1) / Buffer::max_size);
+        for(size_t i = 0; i < count; ++i)
+        {
+            b[i] = Buffer::try_alloc();
+            if(!b[i])
+            {
+                count = i;
+                break;
+            }
+            socket_ops::init_buf(iov[i], b[i]->data, Buffer::max_size);
+        }
+        // The buffers are over their memory budget.
+        if(count == 0)
+            return ENOBUFS;
+
+        size_t bytes = 0;
+        bool complete = socket_ops::non_blocking_recv(socket_, iov, count, 0, true, ec, bytes);
+        if(!complete || ec)
+            bytes = 0;
+
+        size_t left = bytes;
+        for(size_t i = 0; i < count; ++i)
+        {
+            if(left)
+            {
+                b[i]->size = std::min<size_t>(left, Buffer::max_size);
+                left -= b[i]->size;
+                bufs.push(b[i]);
+            }
+            else
+            {
+                b[i]->destroy();
+            }
+        }
+
+        if(!complete)
+            return 0;
+        if(ec)
+            return ec;
+
+        bytes_transferred += bytes;
+        bytes_received.add(bytes);
+        read_sizer_.update(bytes);
+
+        if(bytes < count * Buffer::max_size && !(event & (EPOLLRDHUP | EPOLLHUP)))
+            return 0;
+        want = read_sizer_.grow(bytes);
+    }
+}
+
+int Socket::send(Buffer * buf)
+{
+    if(buf->kind == Buffer::memory)
+    {
+        send_bytes_ += buf->size;
+        send_queued.fetch_add(buf->size, std::memory_order_relaxed);
+    }
+    send_buffers_.push(buf);
+    return flush();
+}
+
+int Socket::send(detail::Queue<Buffer> & bufs)
+{
+    size_t bytes = 0;
+    for(Buffer * b = bufs.front(); b; b = detail::QueueAccess::next(b))
+    {
+        if(b->kind == Buffer::memory)
+            bytes += b->size;
+    }
+    send_bytes_ += bytes;
+    send_queued.fetch_add(bytes, std::memory_order_relaxed);
+    send_buffers_.push(bufs);
+    return flush();
+}
+
+int Socket::send_file(int fd, off_t offset, size_t count, bool close_fd)
+{
+    struct stat st;
+    if(::fstat(fd, &st) == -1)
+        return errno;
+    // A stream has no end to default to.
+    if(!S_ISREG(st.st_mode) && count == 0)
+        return EINVAL;
+
+    Buffer * b = Buffer::alloc();
+    b->fd = fd;
+    b->offset = offset;
+    b->close_fd = close_fd;
+    if(S_ISREG(st.st_mode))
+    {
+        b->kind = Buffer::file;
+        if(count == 0 && st.st_size > offset)
+            count = st.st_size - offset;
+    }
+    else
+    {
+        b->kind = Buffer::stream;
+    }
+    b->size = count;
+
+    int ec = send(b);
+    if(ec)
+    {
+        // The entry failed or sits behind data that did; hand fd back
+        // rather than keep it for a broken connection.
+        if(send_buffers_.front() == b && b->kind == Buffer::stream)
+        {
+            unwatch_source();
+            close_pipe();
+        }
+        send_buffers_.erase(b);
+        b->close_fd = false;
+        b->destroy();
+    }
+    return ec;
+}
+
+void Socket::set_send_watermarks(size_t high, size_t low)
+{
+    high_watermark_ = high;
+    low_watermark_ = std::min(low, high);
+    check_pressure();
+}
+
+void Socket::set_send_limit(size_t bytes)
+{
+    send_limit.store(bytes, std::memory_order_relaxed);
+}
+
+size_t Socket::send_queued_total()
+{
+    return send_queued.load(std::memory_order_relaxed);
+}
+
+int Socket::flush()
+{
+    int ec = write_queue();
+    check_pressure();
+    return ec;
+}
+
+void Socket::check_pressure()
+{
+    if(closed_)
+        return;
+
+    if(paused_)
+    {
+        if(send_bytes_ > low_watermark_)
+            return;
+        if(reactor_->modify_handle(this, events))
+            return;
+        paused_ = false;
+        paused_sockets.sub();
+        // Re-arming EPOLLIN reports data that arrived meanwhile.
+        handle_send_pressure(false);
+        return;
+    }
+
+    if(send_bytes_ <= low_watermark_)
+        return;
+    size_t limit = send_limit.load(std::memory_order_relaxed);
+    bool full = (high_watermark_ && send_bytes_ > high_watermark_)
+        || (limit && send_queued.load(std::memory_order_relaxed) > limit);
+    if(!full || reactor_->modify_handle(this, events & ~(EPOLLIN | EPOLLPRI | EPOLLRDHUP)))
+        return;
+    paused_ = true;
+    read_pauses.add();
+    paused_sockets.add();
+    handle_send_pressure(true);
+}
+
+int Socket::write_queue()
+{
+    while(Buffer * b = send_buffers_.front())
+    {
+        if(closed_)
+            return 0;
+
+        int ec = 0;
+        bool blocked = false;
+        switch(b->kind)
+        {
+        case Buffer::memory:
+            ec = send_memory(b, blocked);
+            break;
+        case Buffer::file:
+        case Buffer::stream:
+        {
+            detail::SigpipeGuard guard;
+            if(b->kind == Buffer::file)
+                ec = send_regular_file(b, blocked);
+            else
+                ec = send_stream(b, blocked);
+            if(ec == EPIPE)
+                guard.consume();
+            break;
+        }
+        }
+
+        if(ec || blocked)
+            return ec;
+
+        if(b->kind != Buffer::memory)
+        {
+            if(b->kind == Buffer::stream)
+                unwatch_source();
+            send_buffers_.pop();
+            b->destroy();
+        }
+    }
+    return 0;
+}
+
+int Socket::send_memory(Buffer * front, bool & blocked)
+{
+    socket_ops::buf bufs[max_iov];
+    size_t count = 0;
+    size_t total = 0;
+    size_t offset = send_offset_;
+    for(Buffer * b = front; b && b->kind == Buffer::memory && count < max_iov;
+        b = detail::QueueAccess::next(b))
+    {
+        socket_ops::init_buf(bufs[count++], b->data + offset, b->size - offset);
+        total += b->size - offset;
+        offset = 0;
+    }
+
+    int ec;
+    size_t bytes = 0;
+    if(!socket_ops::non_blocking_send(socket_, bufs, count, 0, ec, bytes))
+    {
+        blocked = true;
+        return 0;
+    }
+    if(ec)
+        return ec;
+
+    // A short write means the socket buffer is full.
+    blocked = bytes < total;
+    bytes_sent.add(bytes);
+
+    bytes += send_offset_;
+    for(; count; --count)
+    {
+        Buffer * b = send_buffers_.front();
+        if(bytes < b->size)
+            break;
+        bytes -= b->size;
+        send_bytes_ -= b->size;
+        send_queued.fetch_sub(b->size, std::memory_order_relaxed);
+        send_buffers_.pop();
+        b->destroy();
+    }
+    send_offset_ = bytes;
+    return 0;
+}
+
+int Socket::send_regular_file(Buffer * b, bool & blocked)
+{
+    while(b->size)
+    {
+        ssize_t n = ::sendfile(socket_, b->fd, &b->offset, std::min(b->size, max_chunk));
+        if(n > 0)
+        {
+            b->size -= n;
+            bytes_sent.add(n);
+            continue;
+        }
+
+        // The file is shorter than the requested range.
+        if(n == 0)
+            return detail::error::eof;
+
+        if(errno == EINTR)
+            continue;
+        if(errno == EAGAIN || errno == EWOULDBLOCK)
+        {
+            blocked = true;
+            return 0;
+        }
+        return errno;
+    }
+    return 0;
+}
+
+int Socket::send_stream(Buffer * b, bool & blocked)
+{
+    if(pipe_[0] == -1 && ::pipe2(pipe_, O_NONBLOCK | O_CLOEXEC) == -1)
+        return errno;
+
+    while(b->size || pipe_size_)
+    {
+        // Refill the pipe only once the socket took everything in it, so the
+        // pipe never holds data of two entries.
+        if(pipe_size_ == 0)
+        {
+            ssize_t n = ::splice(b->fd, 0, pipe_[1], 0, std::min(b->size, max_chunk),
+                                 SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if(n == 0)
+                return detail::error::eof;
+            if(n < 0)
+            {
+                if(errno == EINTR)
+                    continue;
+                // The source ran dry; its EPOLLIN resumes the transfer.
+                if(errno == EAGAIN)
+                {
+                    blocked = true;
+                    return watch_source(b->fd);
+                }
+                return errno;
+            }
+            b->size -= n;
+            pipe_size_ += n;
+        }
+
+        ssize_t n = ::splice(pipe_[0], 0, socket_, 0, pipe_size_,
+                             SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if(n > 0)
+        {
+            pipe_size_ -= n;
+            bytes_sent.add(n);
+            continue;
+        }
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n == 0 || errno == EAGAIN)
+        {
+            blocked = true;
+            return 0;
+        }
+        return errno;
+    }
+    return 0;
+}
+
+int Socket::watch_source(int fd)
+{
+    if(source_.fd_ == fd)
+        return 0;
+    unwatch_source();
+
+    // Registering reports data that arrived since the splice came up empty.
+    source_.fd_ = fd;
+    int ec = reactor_->register_handle(&source_, EPOLLIN | EPOLLET);
+    if(ec)
+        source_.fd_ = -1;
+    return ec;
+}
+
+void Socket::unwatch_source()
+{
+    if(source_.fd_ != -1)
+    {
+        reactor_->deregister_handle(&source_);
+        source_.fd_ = -1;
+    }
+}
+
+void Socket::StreamSource::handle_events(Event events)
+{
+    // The socket may be destroyed from here.
+    socket_->handle_events(EPOLLOUT);
 }
 
 }// namespace tcp
@@ -1,26 +1,149 @@
 #ifndef SOCKET_H
 #define SOCKET_H
 
+#include <sys/types.h>
+
 #include "reactor.h"
+#include "endpoint.h"
+#include "buffer.h"
+#include "queue.h"
+#include "readsizer.h"
 
 namespace tcp
 {
-    
+
 class Socket : public EventHandler
 {
 public:
-    Socket(Reactor & reactor, int socket);
+    // Pass non_blocking when the socket already is, e.g. from accept4, to
+    // save the FIONBIO ioctl.
+    Socket(Reactor & reactor, int socket, bool non_blocking = false);
     ~Socket();
     bool is_closed() { return closed_; }
 
     virtual int handle() { return socket_; }
+    Reactor & get_reactor() { return *reactor_; }
+
+    // Address of the peer, empty when it cannot be determined.
+    Endpoint remote_endpoint();
+
+    // Read everything the socket has into pooled buffers appended to bufs.
+    // Reads are sized by set_read_mode(). Pass the events being handled: a
+    // short read already shows the socket is drained and ends the reads,
+    // unless they report EPOLLRDHUP or EPOLLHUP, when the peer's FIN may
+    // sit behind the data and no further edge would announce it. Returns an
+    // error code, eof once the peer closed, ENOBUFS when no buffer fits the
+    // memory budget; bufs keeps what was read before.
+    int receive(detail::Queue<Buffer> & bufs, size_t & bytes_transferred, Event event);
+
+    void set_read_mode(detail::ReadSizer::Mode mode) { read_sizer_.set_mode(mode); }
+
+    // Queue buffers behind any pending data and try to write them out. The
+    // socket takes ownership of the buffers. Returns an error code, 0 when the
+    // data was sent or is waiting for EPOLLOUT.
+    int send(Buffer * buf);
+    int send(detail::Queue<Buffer> & bufs);
+
+    // Queue count bytes of fd starting at offset. Regular files are sent with
+    // sendfile, count 0 meaning up to the end. Anything else is spliced
+    // through a pipe and needs a count. While a non-blocking source has no
+    // data the socket watches it for EPOLLIN and passes its readiness on as
+    // EPOLLOUT to handle_events(), so the source must not be registered with
+    // the reactor otherwise. When close_fd is set the socket closes fd once
+    // the transfer is done or dropped. Returns an error code like send(),
+    // which may also come from data queued before; the entry is then
+    // dropped and fd stays with the caller.
+    int send_file(int fd, off_t offset, size_t count, bool close_fd = false);
+
+    // Deregister and hand the descriptor over, e.g. back to a
+    // ConnectionPool, leaving the socket closed. Returns -1 while data is
+    // still queued.
+    int release();
+
+    // Number of queued send entries.
+    size_t send_queue_size() const { return send_buffers_.size(); }
+
+    // Bytes of data in queued memory buffers.
+    size_t send_queue_bytes() const { return send_bytes_; }
+
+    // Stop reading once more than high bytes wait in the send queue and read
+    // again once at most low are left, so a peer that does not read cannot
+    // make the socket buffer without bound. Defaults to
+    // Memory::connection_budget().
+    void set_send_watermarks(size_t high, size_t low);
+
+    // Limit on the bytes queued by all sockets together. While it is
+    // exceeded every socket with more than its low watermark queued stops
+    // reading as well. Off (0) by default.
+    static void set_send_limit(size_t bytes);
+    static size_t send_queued_total();
+
+    bool is_reading_paused() const { return paused_; }
+
+protected:
+    // Write out as much of the send queue as the socket accepts. Call on
+    // EPOLLOUT. Returns an error code, 0 when the queue drained or blocked.
+    int flush();
+
+    // Called when reading pauses for a full send queue and when it resumes.
+    // The socket keeps flushing meanwhile; override to apply a policy, e.g.
+    // close connections that stay paused too long.
+    virtual void handle_send_pressure(bool paused)
+    {
+    }
 
 private:
+    // Watches the source of a stream entry that ran dry.
+    class StreamSource : public EventHandler
+    {
+    public:
+        explicit StreamSource(Socket * socket)
+            : socket_(socket)
+            , fd_(-1)
+        {
+        }
+
+        virtual Handle handle() { return fd_; }
+        virtual void handle_events(Event events);
+
+        Socket * socket_;
+        int fd_;
+    };
+
     void close();
 
+    int write_queue();
+    void check_pressure();
+
+    void close_pipe();
+
+    int send_memory(Buffer * front, bool & blocked);
+    int send_regular_file(Buffer * b, bool & blocked);
+    int send_stream(Buffer * b, bool & blocked);
+
+    int watch_source(int fd);
+    void unwatch_source();
+
+    enum { max_iov = 64, };
+
     Reactor * reactor_;
     int socket_;
     bool closed_;
+
+    detail::Queue<Buffer> send_buffers_;
+    size_t send_offset_;
+    size_t send_bytes_;
+
+    size_t high_watermark_;
+    size_t low_watermark_;
+    bool paused_;
+
+    // Pipe used to splice non-regular sources, created on first use.
+    int pipe_[2];
+    size_t pipe_size_;
+    StreamSource source_;
+
+    detail::ReadSizer read_sizer_;
 };
 
 }// namespace tcp
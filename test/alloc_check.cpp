@@ -0,0 +1,243 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <ostream>
+#include <vector>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <unistd.h>
+
+#include "alloccount.h"
+#include "reactor.h"
+#include "tcp/socket.h"
+#include "tcp/acceptor.h"
+#include "asynclogger.h"
+#include "logger.h"
+#include "loglimiter.h"
+#include "metrics.h"
+#include "systemexception.h"
+#include "queue.h"
+#include "buffer.h"
+
+// Checks that the echo path allocates nothing once connections are set up.
+// Clients and an echo server share one reactor thread and exchange
+// messages; after the warmup messages, which accept the connections and
+// fill the pools, the thread's heap allocations are counted over the
+// measured messages. Exits with 1 when any happened.
+//
+//   alloc_check [-c connections] [-s size] [-w warmup] [-n messages]
+//
+// The echo handler logs every message, to /dev/null through the
+// AsyncLogger, and updates metrics, so those paths are covered as well.
+
+using namespace detail;
+
+namespace
+{
+
+int connections = 8;
+size_t size = 4096;
+uint64_t warmup = 10000;
+uint64_t messages = 100000;
+
+Counter echoed("alloc_check_messages_total", "Messages echoed.");
+Histogram message_bytes("alloc_check_message_bytes", "Bytes per echo read.");
+
+// Per phase, set by the clients.
+uint64_t completed = 0;
+uint64_t allocations_before = 0;
+uint64_t bytes_before = 0;
+uint64_t allocations_after = 0;
+uint64_t bytes_after = 0;
+
+// Logged through its stream operator, the Logger fallback.
+struct Fd
+{
+    int fd;
+};
+
+std::ostream & operator <<(std::ostream & os, const Fd & fd)
+{
+    return os << "fd " << fd.fd;
+}
+
+class EchoSocket : public tcp::Socket
+{
+public:
+    EchoSocket(Reactor & reactor, int socket)
+        : Socket(reactor, socket, true)
+    {
+    }
+
+protected:
+    void handle_events(Event event)
+    {
+        if(event & EPOLLIN)
+        {
+            size_t bytes;
+            Queue<Buffer> bufs;
+            int ec = receive(bufs, bytes, event);
+            message_bytes.record(bytes);
+            LOG_DEBUG << "echo " << bytes << " bytes on " << Fd{ handle() };
+            if(ec || send(bufs))
+            {
+                LOG_LIMITED(Logger::debug_level, 10, 20) << "echo socket " << handle() << " failed";
+                return;
+            }
+            echoed.add();
+        }
+
+        if(event & EPOLLOUT)
+            flush();
+    }
+};
+
+class EchoAcceptor : public tcp::Acceptor
+{
+public:
+    EchoAcceptor(Reactor & reactor, const tcp::Endpoint & ep)
+        : Acceptor(reactor, ep)
+    {
+    }
+
+    std::vector<std::unique_ptr<EchoSocket> > sockets;
+
+protected:
+    void handle_accept(int socket)
+    {
+        sockets.emplace_back(new EchoSocket(get_reactor(), socket));
+    }
+};
+
+class ClientSocket : public tcp::Socket
+{
+public:
+    ClientSocket(Reactor & reactor, int socket)
+        : Socket(reactor, socket)
+        , reactor_(reactor)
+        , pending_(0)
+    {
+        send_message();
+    }
+
+protected:
+    void handle_events(Event event)
+    {
+        if(event & EPOLLIN)
+        {
+            size_t bytes;
+            Queue<Buffer> bufs;
+            receive(bufs, bytes, event);
+            while(Buffer * b = bufs.front())
+            {
+                bufs.pop();
+                b->destroy();
+            }
+            pending_ -= bytes;
+            if(pending_ == 0)
+                complete();
+        }
+
+        if(event & EPOLLOUT)
+            flush();
+    }
+
+private:
+    void send_message()
+    {
+        Queue<Buffer> bufs;
+        for(size_t left = size; left;)
+        {
+            Buffer * b = Buffer::alloc();
+            b->size = std::min<size_t>(left, Buffer::max_size);
+            std::memset(b->data, 'x', b->size);
+            bufs.push(b);
+            left -= b->size;
+        }
+        pending_ = size;
+        send(bufs);
+    }
+
+    void complete()
+    {
+        ++completed;
+        if(completed == warmup)
+        {
+            allocations_before = alloc_count::allocations();
+            bytes_before = alloc_count::bytes();
+        }
+        else if(completed == warmup + messages)
+        {
+            allocations_after = alloc_count::allocations();
+            bytes_after = alloc_count::bytes();
+            reactor_.stop();
+        }
+        send_message();
+    }
+
+    Reactor & reactor_;
+    size_t pending_;
+};
+
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    while((opt = ::getopt(argc, argv, "c:s:w:n:")) != -1)
+    {
+        switch(opt)
+        {
+        case 'c': connections = std::atoi(optarg); break;
+        case 's': size = std::atoi(optarg); break;
+        case 'w': warmup = std::atoll(optarg); break;
+        case 'n': messages = std::atoll(optarg); break;
+        default:
+            std::fprintf(stderr, "usage: %s [-c connections] [-s size] [-w warmup] [-n messages]\n", argv[0]);
+            return 2;
+        }
+    }
+    if(connections < 1 || size < 1 || warmup < 1 || messages < 1)
+        return 2;
+
+    int null = ::open("/dev/null", O_WRONLY | O_CLOEXEC);
+    AsyncLogger::start(null);
+    try
+    {
+        Reactor reactor;
+        reactor.set_profiling(true);
+        tcp::Endpoint ep("127.0.0.1", 0);
+        EchoAcceptor acceptor(reactor, ep);
+        socklen_t len = ep.capacity();
+        ::getsockname(acceptor.handle(), ep.data(), &len);
+        ep.resize(len);
+
+        std::vector<std::unique_ptr<ClientSocket> > clients;
+        for(int i = 0; i < connections; ++i)
+        {
+            int fd = ::socket(ep.family(), SOCK_STREAM | SOCK_CLOEXEC, 0);
+            if(fd == -1 || ::connect(fd, ep.data(), ep.size()) == -1)
+                throw_error(errno, "connect");
+            clients.emplace_back(new ClientSocket(reactor, fd));
+        }
+
+        reactor.run();
+    }
+    catch(const SystemException & err)
+    {
+        std::fprintf(stderr, "%s: %s\n", err.what(), std::strerror(err.ec()));
+        return 2;
+    }
+    AsyncLogger::stop();
+    ::close(null);
+
+    uint64_t allocations = allocations_after - allocations_before;
+    std::printf("%llu messages of %zu bytes over %d connections: %llu allocations (%llu bytes), %.3f per message\n",
+                (unsigned long long)messages, size, connections, (unsigned long long)allocations,
+                (unsigned long long)(bytes_after - bytes_before), double(allocations) / messages);
+    return allocations ? 1 : 0;
+}
@@ -0,0 +1,89 @@
+#include "alloccount.h"
+
+#include <cstddef>
+#include <errno.h>
+
+// glibc's own entry points, which the replacements forward to.
+extern "C"
+{
+void * __libc_malloc(size_t size);
+void * __libc_calloc(size_t count, size_t size);
+void * __libc_realloc(void * p, size_t size);
+void * __libc_memalign(size_t alignment, size_t size);
+void __libc_free(void * p);
+}
+
+namespace
+{
+
+// Plain initial-exec thread locals: reading them never allocates, which
+// would recurse.
+__thread uint64_t thread_allocations;
+__thread uint64_t thread_bytes;
+__thread uint64_t thread_frees;
+
+void count(size_t size)
+{
+    ++thread_allocations;
+    thread_bytes += size;
+}
+
+}
+
+namespace alloc_count
+{
+
+uint64_t allocations() { return thread_allocations; }
+uint64_t bytes() { return thread_bytes; }
+uint64_t frees() { return thread_frees; }
+
+}
+
+extern "C"
+{
+
+void * malloc(size_t size)
+{
+    count(size);
+    return __libc_malloc(size);
+}
+
+void * calloc(size_t n, size_t size)
+{
+    count(n * size);
+    return __libc_calloc(n, size);
+}
+
+void * realloc(void * p, size_t size)
+{
+    count(size);
+    return __libc_realloc(p, size);
+}
+
+void * memalign(size_t alignment, size_t size)
+{
+    count(size);
+    return __libc_memalign(alignment, size);
+}
+
+void * aligned_alloc(size_t alignment, size_t size)
+{
+    count(size);
+    return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void ** p, size_t alignment, size_t size)
+{
+    count(size);
+    *p = __libc_memalign(alignment, size);
+    return *p ? 0 : ENOMEM;
+}
+
+void free(void * p)
+{
+    if(p)
+        ++thread_frees;
+    __libc_free(p);
+}
+
+}
@@ -0,0 +1,23 @@
+#ifndef ALLOCCOUNT_H
+#define ALLOCCOUNT_H
+
+#include <stdint.h>
+
+// Heap allocation counts of the calling thread. Linking alloccount.cpp into
+// an executable replaces malloc and its relatives for the whole process, so
+// it belongs in test programs only; operator new and the standard
+// containers allocate through malloc and are counted too. glibc only.
+namespace alloc_count
+{
+
+// Calls to malloc, calloc, realloc and the aligned variants so far.
+uint64_t allocations();
+
+// Bytes requested by those calls.
+uint64_t bytes();
+
+uint64_t frees();
+
+}
+
+#endif // ALLOCCOUNT_H
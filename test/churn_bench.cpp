@@ -0,0 +1,364 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <dirent.h>
+#include <getopt.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "reactor.h"
+#include "deadlinetimer.h"
+#include "tcp/socket.h"
+#include "tcp/pooledacceptor.h"
+#include "systemexception.h"
+#include "tscclock.h"
+#include "queue.h"
+#include "buffer.h"
+
+// Short-lived connection benchmark. Client threads connect, send one byte,
+// wait for the echo and close, over and over, against an echo server built
+// like echo_server_tcp running on its own reactor thread. Reports
+// connections per second, the server thread's CPU per connection, its time
+// per connection split by phase, and descriptor and memory growth. The
+// phases are wall time on the server thread from the TSC, so they include
+// preemption; reading the thread's CPU clock around each phase would cost
+// a syscall per reading and distort them. Only the total is CPU time.
+//
+//   churn_bench [-n connections] [-c client-threads] [-u unix-path] [-r]
+//
+// -r closes with a reset (SO_LINGER 0) so clients do not pile up TIME_WAIT
+// sockets and run out of ports.
+
+using namespace detail;
+
+namespace
+{
+
+int total = 20000;
+int clients = 4;
+std::string path;
+bool reset = false;
+
+std::atomic<bool> done(false);
+
+// Server side phase times in TSC ticks; written by the server thread only.
+// close covers destroy() and the deferred release after the batch, which
+// runs the socket's destructor and close(2).
+struct Phases
+{
+    uint64_t accept;
+    uint64_t setup;
+    uint64_t first_byte;
+    uint64_t close;
+};
+
+Phases phases = { 0, 0, 0, 0 };
+
+size_t open_fds()
+{
+    size_t n = 0;
+    if(DIR * d = ::opendir("/proc/self/fd"))
+    {
+        while(dirent * e = ::readdir(d))
+        {
+            if(e->d_name[0] != '.')
+                ++n;
+        }
+        ::closedir(d);
+    }
+    return n;
+}
+
+double rss_mb()
+{
+    long pages = 0, resident = 0;
+    if(FILE * f = std::fopen("/proc/self/statm", "r"))
+    {
+        if(std::fscanf(f, "%ld %ld", &pages, &resident) != 2)
+            resident = 0;
+        std::fclose(f);
+    }
+    return resident * double(::sysconf(_SC_PAGESIZE)) / (1 << 20);
+}
+
+double thread_cpu_seconds()
+{
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+class ChurnServer;
+
+// Stops the close clock once tcp::Socket's destructor closed the
+// descriptor: as the first base of ChurnSocket it is destroyed last.
+struct CloseTiming
+{
+    CloseTiming()
+        : close_start(0)
+    {
+    }
+
+    ~CloseTiming()
+    {
+        if(close_start)
+            phases.close += TscClock::now() - close_start;
+    }
+
+    uint64_t close_start;
+};
+
+class ChurnSocket : private CloseTiming, public tcp::Socket
+{
+public:
+    ChurnSocket(Reactor & reactor, int socket, ChurnServer & server)
+        : Socket(reactor, socket, true)
+        , server_(server)
+        , answered_(false)
+        , closing_(false)
+    {
+    }
+
+    // Runs in the deferred release after the batch.
+    ~ChurnSocket()
+    {
+        if(closing_)
+            close_start = TscClock::now();
+    }
+
+protected:
+    void handle_events(Event event);
+
+private:
+    void close();
+
+    ChurnServer & server_;
+    bool answered_;
+    bool closing_;
+};
+
+class ChurnServer : public tcp::PooledAcceptor<ChurnSocket>
+{
+public:
+    ChurnServer(Reactor & reactor, const tcp::Endpoint & ep)
+        : PooledAcceptor(reactor, ep)
+        , closed_(0)
+        , peak_(0)
+        , inner_(0)
+    {
+    }
+
+    // Times the deregistration; the rest of the close is timed when the
+    // socket is released after the batch.
+    void close(ChurnSocket * s)
+    {
+        uint64_t start = TscClock::now();
+        pool().destroy(s);
+        phases.close += TscClock::now() - start;
+        ++closed_;
+    }
+
+    int closed() const { return closed_; }
+    size_t peak() const { return peak_; }
+
+protected:
+    void handle_events(Event event)
+    {
+        // Accepting is what the acceptor spends outside handle_accept().
+        uint64_t start = TscClock::now();
+        inner_ = 0;
+        Acceptor::handle_events(event);
+        phases.accept += TscClock::now() - start - inner_;
+    }
+
+    ChurnSocket * create_socket(int socket)
+    {
+        uint64_t start = TscClock::now();
+        ChurnSocket * s = pool().create(get_reactor(), socket, *this);
+        peak_ = std::max(peak_, pool().size());
+        uint64_t ticks = TscClock::now() - start;
+        phases.setup += ticks;
+        inner_ += ticks;
+        return s;
+    }
+
+private:
+    int closed_;
+    size_t peak_;
+    uint64_t inner_;
+};
+
+void ChurnSocket::close()
+{
+    closing_ = true;
+    server_.close(this);
+}
+
+void ChurnSocket::handle_events(Event event)
+{
+    if(event & EPOLLIN)
+    {
+        Queue<Buffer> bufs;
+        size_t bytes;
+        uint64_t start = TscClock::now();
+        int ec = receive(bufs, bytes, event);
+        if(bytes && !answered_)
+        {
+            answered_ = true;
+            ec = ec ? ec : send(bufs);
+            phases.first_byte += TscClock::now() - start;
+        }
+        if(ec)
+        {
+            close();
+            return;
+        }
+    }
+
+    if(event & EPOLLOUT)
+    {
+        if(flush())
+        {
+            close();
+            return;
+        }
+    }
+
+    if(event & (EPOLLERR | EPOLLHUP))
+        close();
+}
+
+class StopTimer : public DeadlineTimer
+{
+public:
+    StopTimer(Reactor & reactor, ChurnServer & server)
+        : DeadlineTimer(reactor)
+        , reactor_(reactor)
+        , server_(server)
+    {
+        set_interval(1);
+    }
+
+protected:
+    void handle_events(Event event)
+    {
+        uint64_t exp;
+        while(::read(handle(), &exp, sizeof(exp)) == sizeof(exp))
+            ;
+        if(done || server_.closed() >= total)
+            reactor_.stop();
+    }
+
+private:
+    Reactor & reactor_;
+    ChurnServer & server_;
+};
+
+void client(const tcp::Endpoint & ep, int count, std::atomic<int> & failures)
+{
+    for(int i = 0; i < count; ++i)
+    {
+        int fd = ::socket(ep.family(), SOCK_STREAM | SOCK_CLOEXEC, 0);
+        char c = 'x';
+        if(fd == -1 || ::connect(fd, ep.data(), ep.size()) == -1
+           || ::write(fd, &c, 1) != 1 || ::read(fd, &c, 1) != 1)
+            ++failures;
+        if(fd != -1)
+        {
+            if(reset)
+            {
+                linger l = { 1, 0 };
+                ::setsockopt(fd, SOL_SOCKET, SO_LINGER, &l, sizeof(l));
+            }
+            ::close(fd);
+        }
+    }
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    while((opt = ::getopt(argc, argv, "n:c:u:r")) != -1)
+    {
+        switch(opt)
+        {
+        case 'n': total = std::atoi(optarg); break;
+        case 'c': clients = std::atoi(optarg); break;
+        case 'u': path = optarg; break;
+        case 'r': reset = true; break;
+        default:
+            std::fprintf(stderr, "usage: %s [-n connections] [-c client-threads] [-u unix-path] [-r]\n", argv[0]);
+            return 1;
+        }
+    }
+    if(total < 1 || clients < 1)
+        return 1;
+
+    tcp::Endpoint ep = path.empty() ? tcp::Endpoint("127.0.0.1", 0) : tcp::Endpoint::local(path);
+
+    Reactor reactor;
+    ChurnServer server(reactor, ep);
+    if(path.empty())
+    {
+        socklen_t size = ep.capacity();
+        ::getsockname(server.handle(), ep.data(), &size);
+        ep.resize(size);
+    }
+    StopTimer timer(reactor, server);
+
+    // Calibrate outside the measurement.
+    TscClock::ticks_per_us();
+
+    // Taken with the server set up, so any growth is per connection.
+    size_t fds_before = open_fds();
+    double rss_before = rss_mb();
+
+    double server_cpu = 0;
+    std::thread server_thread([&]
+    {
+        double start = thread_cpu_seconds();
+        reactor.run();
+        server_cpu = thread_cpu_seconds() - start;
+    });
+
+    std::atomic<int> failures(0);
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for(int i = 0; i < clients; ++i)
+        threads.emplace_back(client, ep, total / clients + (i < total % clients), std::ref(failures));
+    for(auto & t : threads)
+        t.join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // Give the server a moment to see the last closes.
+    for(int i = 0; i < 100 && server.closed() < total - failures; ++i)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    done = true;
+    server_thread.join();
+
+    int served = server.closed();
+    double us = 1 / TscClock::ticks_per_us() / std::max(served, 1);
+    std::printf("%d connections in %.2fs, %.0f conn/s (%d client threads, %s%s), %d failed\n",
+                total, seconds, total / seconds, clients, path.empty() ? "tcp" : "unix",
+                reset ? ", reset" : "", failures.load());
+    std::printf("server cpu per connection %.2fus\n", server_cpu * 1e6 / std::max(served, 1));
+    std::printf("server thread time per connection by phase, including preemption\n");
+    std::printf("  accept      %.2fus\n", phases.accept * us);
+    std::printf("  setup       %.2fus   socket, epoll register, bookkeeping\n", phases.setup * us);
+    std::printf("  first byte  %.2fus   read and echo\n", phases.first_byte * us);
+    std::printf("  close       %.2fus   deregister, release after the batch, close(2)\n", phases.close * us);
+    std::printf("fds %zu before, %zu after, %zu peak connections; rss %.1f MB before, %.1f MB after\n",
+                fds_before, open_fds(), server.peak(), rss_before, rss_mb());
+
+    return failures ? 2 : 0;
+}
@@ -0,0 +1,174 @@
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "reactor.h"
+#include "deadlinetimer.h"
+#include "tcp/acceptor.h"
+#include "tcp/connectionpool.h"
+#include "systemexception.h"
+
+// Checks tcp::ConnectionPool against a loopback listener on the same
+// reactor: a connection put back is handed out again, one the peer closed
+// meanwhile is discarded for a new connect, and idle connections expire
+// after idle_timeout. Exits with 1 when a case fails.
+//
+//   connection_pool_check
+
+namespace
+{
+
+int failures = 0;
+
+void expect(bool ok, const char * what)
+{
+    std::printf("%-48s %s\n", what, ok ? "ok" : "FAILED");
+    if(!ok)
+        ++failures;
+}
+
+// Keeps the server side of every connection until told to close it.
+class Listener : public tcp::Acceptor
+{
+public:
+    Listener(Reactor & reactor, const tcp::Endpoint & ep)
+        : Acceptor(reactor, ep)
+    {
+    }
+
+    ~Listener()
+    {
+        for(int s : accepted_)
+            ::close(s);
+    }
+
+    size_t accepted() const { return accepted_.size(); }
+
+    void close_last()
+    {
+        ::close(accepted_.back());
+        accepted_.pop_back();
+        ++closed_;
+    }
+
+    size_t closed() const { return closed_; }
+
+protected:
+    void handle_accept(int socket)
+    {
+        accepted_.push_back(socket);
+    }
+
+private:
+    std::vector<int> accepted_;
+    size_t closed_ = 0;
+};
+
+// Runs the reactor until done() holds or limit ticks of tick passed, and
+// calls the pool's check_timeout() on each tick.
+template <typename Done>
+class Waiter : public DeadlineTimer
+{
+public:
+    Waiter(Reactor & reactor, tcp::ConnectionPool & pool, Done done, int limit)
+        : DeadlineTimer(reactor)
+        , reactor_(reactor)
+        , pool_(pool)
+        , done_(done)
+        , left_(limit)
+    {
+        set_period(MonoClock::milliseconds(tick_ms));
+    }
+
+    enum { tick_ms = 10 };
+
+protected:
+    void handle_events(Event event)
+    {
+        uint64_t expirations;
+        while(::read(handle(), &expirations, sizeof(expirations)) == sizeof(expirations))
+            ;
+        pool_.check_timeout();
+        if(done_() || --left_ <= 0)
+            reactor_.stop();
+    }
+
+private:
+    Reactor & reactor_;
+    tcp::ConnectionPool & pool_;
+    Done done_;
+    int left_;
+};
+
+template <typename Done>
+void run_until(Reactor & reactor, tcp::ConnectionPool & pool, Done done, int limit_ms = 3000)
+{
+    Waiter<Done> waiter(reactor, pool, done, limit_ms / Waiter<Done>::tick_ms);
+    reactor.run();
+}
+
+// Get a connection, waiting for a new one to be established.
+int get(Reactor & reactor, tcp::ConnectionPool & pool, const tcp::Endpoint & ep)
+{
+    int socket = -1;
+    bool called = false;
+    pool.get(ep, [&](int s, int ec)
+    {
+        called = true;
+        socket = ec ? -1 : s;
+    });
+    run_until(reactor, pool, [&]() { return called; });
+    return socket;
+}
+
+}
+
+int main()
+{
+    try
+    {
+        Reactor reactor;
+        tcp::Endpoint ep("127.0.0.1", 0);
+        Listener listener(reactor, ep);
+        socklen_t size = ep.capacity();
+        ::getsockname(listener.handle(), ep.data(), &size);
+        ep.resize(size);
+
+        tcp::ConnectionPool pool(reactor, 5, 1);
+
+        int s1 = get(reactor, pool, ep);
+        run_until(reactor, pool, [&]() { return listener.accepted() == 1; });
+        expect(s1 != -1 && listener.accepted() == 1, "first get connects");
+
+        pool.put(ep, s1);
+        expect(pool.idle_count() == 1, "put back connection is idle");
+        int s2 = get(reactor, pool, ep);
+        expect(s2 == s1 && listener.accepted() == 1, "put back connection is reused");
+        expect(pool.idle_endpoints() == 0, "empty endpoint entry is erased");
+
+        // The peer closes while the connection is parked.
+        pool.put(ep, s2);
+        listener.close_last();
+        run_until(reactor, pool, [&]() { return false; }, 50);
+        int s3 = get(reactor, pool, ep);
+        run_until(reactor, pool, [&]() { return listener.accepted() == 1; });
+        expect(s3 != -1 && listener.accepted() == 1 && listener.closed() == 1,
+               "connection closed by the peer is replaced");
+        expect(pool.idle_count() == 0 && pool.idle_endpoints() == 0, "closed connection is discarded");
+
+        // idle_timeout is 1s; the waiter calls check_timeout() every tick.
+        pool.put(ep, s3);
+        run_until(reactor, pool, [&]() { return pool.idle_count() == 0; });
+        expect(pool.idle_count() == 0, "idle connection expires");
+        expect(pool.idle_endpoints() == 0, "expired endpoint entry is erased");
+    }
+    catch(const SystemException & err)
+    {
+        std::fprintf(stderr, "%s\n", err.what());
+        return 2;
+    }
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,444 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <getopt.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "reactor.h"
+#include "tcp/socket.h"
+#include "tcp/connector.h"
+#include "metrics.h"
+#include "systemexception.h"
+#include "queue.h"
+#include "buffer.h"
+
+// Load generator for echo_server_tcp. Opens connections across threads, one
+// reactor per thread, and sends fixed size messages, either keeping depth
+// messages in flight per connection (closed loop) or at a fixed total rate
+// (open loop). Latency is measured from when a message was due to be sent,
+// not when it was, so a stalled server is charged for the messages it kept
+// the generator from sending (coordinated omission). In closed loop the due
+// time is the send time.
+//
+//   echo_load [-h host] [-p port] [-u unix-path] [-c connections]
+//             [-t threads] [-s size] [-d depth] [-r rate] [-D seconds]
+//             [-w warmup-seconds] [-j]
+//
+// -j prints one JSON object instead of the text report.
+
+using namespace detail;
+
+namespace
+{
+
+struct Options
+{
+    Options()
+        : host("127.0.0.1")
+        , port(20000)
+        , connections(16)
+        , threads(1)
+        , size(64)
+        , depth(1)
+        , rate(0)
+        , duration(10)
+        , warmup(1)
+        , json(false)
+    {
+    }
+
+    std::string host;
+    int port;
+    std::string path;
+    int connections;
+    int threads;
+    size_t size;
+    int depth;
+    double rate;
+    int duration;
+    int warmup;
+    bool json;
+};
+
+Options options;
+
+std::atomic<bool> stopping(false);
+
+// Messages completed before this time are not recorded.
+std::atomic<uint64_t> record_after(0);
+
+Histogram latency("echo_load_latency_ns", "Message round trip in nanoseconds.");
+
+uint64_t now_ns()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+struct Stats
+{
+    Stats()
+        : sent(0)
+        , received(0)
+        , bytes(0)
+        , errors(0)
+        , max_ns(0)
+    {
+    }
+
+    uint64_t sent;
+    uint64_t received;
+    uint64_t bytes;
+    uint64_t errors;
+    uint64_t max_ns;
+};
+
+class LoadSocket : public tcp::Socket
+{
+public:
+    LoadSocket(Reactor & reactor, int socket, Stats & stats, uint64_t first_send, uint64_t interval)
+        : Socket(reactor, socket, true)
+        , stats_(stats)
+        , next_send_(first_send)
+        , interval_(interval)
+        , pending_bytes_(0)
+        , failed_(false)
+    {
+        if(!interval_)
+        {
+            for(int i = 0; i < options.depth; ++i)
+                send_message(now_ns());
+        }
+    }
+
+    // Open loop: send every message that fell due by now.
+    void tick(uint64_t now)
+    {
+        while(!failed_ && next_send_ <= now)
+        {
+            send_message(next_send_);
+            next_send_ += interval_;
+        }
+    }
+
+protected:
+    void handle_events(Event event)
+    {
+        if(failed_)
+            return;
+
+        if(event & EPOLLIN)
+        {
+            Queue<Buffer> bufs;
+            size_t bytes;
+            int ec = receive(bufs, bytes, event);
+            complete(bytes);
+            if(ec)
+            {
+                fail();
+                return;
+            }
+        }
+
+        if(event & EPOLLOUT)
+        {
+            if(flush())
+            {
+                fail();
+                return;
+            }
+        }
+
+        if(event & (EPOLLERR | EPOLLHUP))
+            fail();
+    }
+
+private:
+    void send_message(uint64_t due)
+    {
+        Queue<Buffer> bufs;
+        for(size_t left = options.size; left;)
+        {
+            Buffer * b = Buffer::alloc();
+            b->size = std::min<size_t>(left, Buffer::max_size);
+            std::memset(b->data, 'x', b->size);
+            bufs.push(b);
+            left -= b->size;
+        }
+        due_.push_back(due);
+        ++stats_.sent;
+        if(send(bufs))
+            fail();
+    }
+
+    void complete(size_t bytes)
+    {
+        stats_.bytes += bytes;
+        pending_bytes_ += bytes;
+        uint64_t now = now_ns();
+        while(pending_bytes_ >= options.size && !due_.empty())
+        {
+            pending_bytes_ -= options.size;
+            uint64_t ns = now - due_.front();
+            due_.pop_front();
+            if(now >= record_after.load(std::memory_order_relaxed))
+            {
+                latency.record(ns);
+                stats_.max_ns = std::max(stats_.max_ns, ns);
+                ++stats_.received;
+            }
+            if(!interval_ && !stopping.load(std::memory_order_relaxed))
+                send_message(now);
+        }
+    }
+
+    void fail()
+    {
+        if(!failed_)
+        {
+            failed_ = true;
+            ++stats_.errors;
+        }
+    }
+
+    Stats & stats_;
+    uint64_t next_send_;
+    uint64_t interval_;
+    size_t pending_bytes_;
+    std::deque<uint64_t> due_;
+    bool failed_;
+};
+
+class Worker;
+
+class LoadConnector : public tcp::Connector
+{
+public:
+    LoadConnector(Worker & worker, Reactor & reactor)
+        : Connector(reactor)
+        , worker_(worker)
+    {
+    }
+
+protected:
+    void handle_connect(int socket, int ec);
+
+private:
+    Worker & worker_;
+};
+
+// One thread: a reactor, its share of the connections and a tick that drives
+// the open loop schedule and notices the end of the run.
+class Worker : public EventHandler
+{
+public:
+    Worker(int index, int connections)
+        : index_(index)
+        , connections_(connections)
+        , timer_fd_(::timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC))
+    {
+        if(timer_fd_ == -1)
+            throw_error(errno, "timerfd");
+    }
+
+    ~Worker()
+    {
+        ::close(timer_fd_);
+    }
+
+    virtual int handle() { return timer_fd_; }
+
+    void run()
+    {
+        Metrics::set_thread_name("worker-" + std::to_string(index_));
+
+        // Messages go out on the tick after they fall due, so an open loop
+        // ticks finer to keep that slack out of the latencies.
+        long ns = options.rate > 0 ? 100000 : 1000000;
+        itimerspec tick = { { 0, ns }, { 0, ns } };
+        ::timerfd_settime(timer_fd_, 0, &tick, 0);
+        reactor_.register_handle(this, EPOLLIN | EPOLLET);
+
+        tcp::Endpoint ep = options.path.empty()
+            ? tcp::Endpoint(options.host, options.port)
+            : tcp::Endpoint::local(options.path);
+        for(int i = 0; i < connections_; ++i)
+        {
+            connectors_.emplace_back(new LoadConnector(*this, reactor_));
+            connectors_.back()->connect(ep, 5);
+        }
+
+        reactor_.run();
+        reactor_.deregister_handle(this);
+    }
+
+    void add(int socket, int ec)
+    {
+        if(ec)
+        {
+            ++stats_.errors;
+            return;
+        }
+
+        uint64_t interval = 0;
+        uint64_t first = 0;
+        if(options.rate > 0)
+        {
+            // Spread the connections evenly over one interval.
+            interval = uint64_t(options.connections * 1e9 / options.rate);
+            first = now_ns() + interval * sockets_.size() / connections_;
+        }
+        sockets_.emplace_back(new LoadSocket(reactor_, socket, stats_, first, interval));
+    }
+
+    const Stats & stats() const { return stats_; }
+
+protected:
+    void handle_events(Event event)
+    {
+        uint64_t expirations;
+        while(::read(timer_fd_, &expirations, sizeof(expirations)) == sizeof(expirations))
+            ;
+
+        if(stopping.load(std::memory_order_relaxed))
+        {
+            reactor_.stop();
+            return;
+        }
+
+        MonoTime now = reactor_.now();
+        for(auto & c : connectors_)
+            c->check_timeout(now);
+
+        if(options.rate > 0)
+        {
+            uint64_t ns = now_ns();
+            for(auto & s : sockets_)
+                s->tick(ns);
+        }
+    }
+
+private:
+    int index_;
+    int connections_;
+    int timer_fd_;
+    Reactor reactor_;
+    Stats stats_;
+    std::vector<std::unique_ptr<LoadConnector> > connectors_;
+    std::vector<std::unique_ptr<LoadSocket> > sockets_;
+};
+
+void LoadConnector::handle_connect(int socket, int ec)
+{
+    worker_.add(socket, ec);
+}
+
+void usage(const char * name)
+{
+    std::fprintf(stderr,
+                 "usage: %s [-h host] [-p port] [-u unix-path] [-c connections] [-t threads]\n"
+                 "          [-s size] [-d depth] [-r rate] [-D seconds] [-w warmup-seconds] [-j]\n",
+                 name);
+    std::exit(1);
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    while((opt = ::getopt(argc, argv, "h:p:u:c:t:s:d:r:D:w:j")) != -1)
+    {
+        switch(opt)
+        {
+        case 'h': options.host = optarg; break;
+        case 'p': options.port = std::atoi(optarg); break;
+        case 'u': options.path = optarg; break;
+        case 'c': options.connections = std::atoi(optarg); break;
+        case 't': options.threads = std::atoi(optarg); break;
+        case 's': options.size = std::atoi(optarg); break;
+        case 'd': options.depth = std::atoi(optarg); break;
+        case 'r': options.rate = std::atof(optarg); break;
+        case 'D': options.duration = std::atoi(optarg); break;
+        case 'w': options.warmup = std::atoi(optarg); break;
+        case 'j': options.json = true; break;
+        default: usage(argv[0]);
+        }
+    }
+    if(options.connections < 1 || options.threads < 1 || options.size < 1 || options.depth < 1
+       || options.duration < 1 || options.warmup < 0)
+        usage(argv[0]);
+    options.threads = std::min(options.threads, options.connections);
+
+    std::vector<std::unique_ptr<Worker> > workers;
+    for(int i = 0; i < options.threads; ++i)
+    {
+        int share = options.connections / options.threads + (i < options.connections % options.threads);
+        workers.emplace_back(new Worker(i, share));
+    }
+
+    record_after = now_ns() + uint64_t(options.warmup) * 1000000000;
+
+    std::vector<std::thread> threads;
+    for(auto & w : workers)
+        threads.emplace_back(&Worker::run, w.get());
+
+    std::this_thread::sleep_for(std::chrono::seconds(options.warmup + options.duration));
+    stopping = true;
+    for(auto & t : threads)
+        t.join();
+
+    Stats total;
+    for(auto & w : workers)
+    {
+        const Stats & s = w->stats();
+        total.sent += s.sent;
+        total.received += s.received;
+        total.bytes += s.bytes;
+        total.errors += s.errors;
+        total.max_ns = std::max(total.max_ns, s.max_ns);
+    }
+
+    double seconds = options.duration;
+    double p50 = latency.percentile(0.5) / 1e3;
+    double p99 = latency.percentile(0.99) / 1e3;
+    double p999 = latency.percentile(0.999) / 1e3;
+    double max = total.max_ns / 1e3;
+    const char * mode = options.rate > 0 ? "open" : "closed";
+
+    if(options.json)
+    {
+        std::printf("{\"mode\":\"%s\",\"connections\":%d,\"threads\":%d,\"size\":%zu,\"depth\":%d,"
+                    "\"rate\":%.0f,\"duration_s\":%d,\"messages\":%llu,\"errors\":%llu,"
+                    "\"msgs_per_s\":%.0f,\"mb_per_s\":%.2f,"
+                    "\"p50_us\":%.1f,\"p99_us\":%.1f,\"p999_us\":%.1f,\"max_us\":%.1f}\n",
+                    mode, options.connections, options.threads, options.size, options.depth,
+                    options.rate, options.duration, (unsigned long long)total.received,
+                    (unsigned long long)total.errors, total.received / seconds,
+                    total.received * options.size / seconds / 1e6, p50, p99, p999, max);
+    }
+    else
+    {
+        std::printf("%s loop, %d connections on %d threads, %zu byte messages\n",
+                    mode, options.connections, options.threads, options.size);
+        std::printf("  messages  %llu (%.0f/s, %.2f MB/s), errors %llu\n",
+                    (unsigned long long)total.received, total.received / seconds,
+                    total.received * options.size / seconds / 1e6,
+                    (unsigned long long)total.errors);
+        std::printf("  latency   p50 %.1fus  p99 %.1fus  p999 %.1fus  max %.1fus\n",
+                    p50, p99, p999, max);
+    }
+
+    return total.errors ? 2 : 0;
+}
@@ -1,104 +1,65 @@
 #include <list>
-#include <unordered_set>
 #include <vector>
 #include <sys/epoll.h>
 #include <unistd.h>
-#include <atomic>
+#include <cstdlib>
+#include <memory>
 
 #include "logger.h"
+#include "asynclogger.h"
+#include "loglimiter.h"
 #include "tcp/socket.h"
-#include "tcp/acceptor.h"
+#include "tcp/pooledacceptor.h"
+#include "tcp/admission.h"
+#include "tcp/metricsserver.h"
+#include "metrics.h"
+#include "watchdog.h"
+#include "trace.h"
+#include "handlerpool.h"
+#include "memory.h"
+#include "pooltrimmer.h"
 #include "deadlinetimer.h"
 #include "systemexception.h"
 #include "socketops.h"
 #include "queue.h"
-#include "objectpool.h"
+#include "buffer.h"
 
-std::atomic<uint64_t> read_event_count(0);
-std::atomic<uint64_t> write_event_count(0);
-
-#define __DEBUG__
+Counter read_events("echo_read_events_total", "EPOLLIN events handled by echo sockets.");
+Counter write_events("echo_write_events_total", "EPOLLOUT events handled by echo sockets.");
 
 using namespace detail;
 
-class EchoSocket;
-
-class EchoSocketManager
-{
-public:
-    void add(EchoSocket *s);
-
-    void del(EchoSocket *s);
-
-    void check_timeout();
-private:
-    std::unordered_set<EchoSocket *> sockets_;
-};
-
-EchoSocketManager socket_manager;
-
-class Buffer : private Noncopyable
-{
-    friend class detail::QueueAccess;
-    friend class detail::ObjectPoolAccess;
-public:
-    Buffer()
-        :size(0)
-    {
-    }
-
-    void destroy();
-
-    enum { max_size = 256, };
-    char data[max_size];
-
-    Buffer * next_;
-    Buffer * prev;
-    Buffer * next;
-    size_t size;
-};
-
-ObjectPool<Buffer> buffer_pool;
-
-void Buffer::destroy()
-{
-    buffer_pool.free(this);
-}
-
 class EchoSocket : public tcp::Socket
 {
 public:
-    EchoSocket(Reactor & reactor, int sockfd)
-        : Socket(reactor, sockfd)
-        , send_buffer_offset_(0)
-        , timestamp_(std::time(0))
-    {
-    }
-
-    bool send(Buffer * buf)
+    typedef HandlerPool<EchoSocket> Pool;
+
+    EchoSocket(Reactor & reactor, int sockfd, Pool & pool,
+               tcp::Admission * admission, tcp::Admission::Key source)
+        : Socket(reactor, sockfd, true)
+        , pool_(pool)
+        , admission_(admission)
+        , source_(source)
+        , timestamp_(reactor.now())
     {
-        //if(send_buffers_.size() > 10240)
-        //    return false;
-        send_buffers_.push(buf);
-        do_send();
-        return true;
+        LOG_DEBUG << "add socket: " << sockfd ;
     }
 
-    bool send(Queue<Buffer> & bufs)
+    bool check_timeout(MonoTime now)
     {
-        if(send_buffers_.size() > 10240)
+        if(timestamp_ + MonoClock::seconds(60) > now)
             return false;
-        send_buffers_.push(bufs);
-        do_send();
-        return true;
+        else
+            return true;
     }
 
-    bool check_timeout(time_t now)
+    void close()
     {
-        if(timestamp_ + 60 > now)
-            return false;
-        else
-            return true;
+        LOG_DEBUG << "del socket: " << handle() ;
+        if(admission_)
+            admission_->release(source_);
+        source_ = 0;
+        pool_.destroy(this);
     }
 
 protected:
@@ -112,47 +73,36 @@ protected:
 //#endif
         if(event & EPOLLIN)
         {
-			++read_event_count;
-            int ec;
+			read_events.add();
             size_t bytes;
             Queue<Buffer> bufs;
-
-            while(true)
+            int ec = receive(bufs, bytes, event);
+            if(ec)
             {
-                Buffer *b = alloc_buffer();
-                socket_ops::buf buf;
-                socket_ops::init_buf(buf, b->data, b->max_size);
-                bool ret = socket_ops::non_blocking_recv(handle(), &buf, 1, 0, true, ec, bytes);
-                if(ret == false)
-                {
-                    free_buffer(b);
-                    break;
-                }
-
-                if(ec)
-                {
-					Logger::debug() << "socket recv err(" << ec << "): " << strerror(ec) << event ; 
-                    free_buffer(b);
-                    close();
-                    return;
-                }
-
-                b->size = bytes;
-                bufs.push(b);
+				LOG_LIMITED(Logger::debug_level, 10, 20) << "socket recv err(" << ec << "): " << strerror(ec) << event ; 
+                close();
+                return;
+            }
+            ec = send(bufs);
+            if(ec)
+            {
+			    LOG_LIMITED(Logger::debug_level, 10, 20) << "socket send err(" << ec << "): " << strerror(ec) ; 
+                close();
+                return;
             }
-            if(send(bufs) == false)
-			{
-			  Logger::debug() << "send buf too long";
-			  close();
-			  return;
-			}
-            timestamp_ = std::time(0);
+            timestamp_ = get_reactor().now();
         }
 
         if(event & EPOLLOUT)
         {
-			++write_event_count;
-            do_send();
+			write_events.add();
+            int ec = flush();
+            if(ec)
+            {
+			    LOG_LIMITED(Logger::debug_level, 10, 20) << "socket send err(" << ec << "): " << strerror(ec) ; 
+                close();
+                return;
+            }
         }
 
         if(event & (EPOLLERR | EPOLLHUP))
@@ -161,160 +111,62 @@ protected:
         }
     }
 
-private:
-	Buffer * alloc_buffer()
+    void handle_send_pressure(bool paused)
     {
-        return buffer_pool.alloc();
-        //return new Buffer;
+        LOG_LIMITED(Logger::debug_level, 10, 20) << "socket " << handle()
+            << (paused ? " paused, " : " resumed, ") << send_queue_bytes() << " bytes queued";
     }
 
-	void free_buffer(Buffer * b)
-    {
-        buffer_pool.free(b);
-        //delete b;
-	}
+private:
+    Pool & pool_;
+    tcp::Admission * admission_;
+    tcp::Admission::Key source_;
+    MonoTime timestamp_;
+};
 
-    void close()
+
+class EchoAcceptor : public tcp::PooledAcceptor<EchoSocket>
+{
+public:
+    EchoAcceptor(Reactor & reactor, const tcp::Endpoint & endpoint, tcp::Admission * admission)
+        : PooledAcceptor(reactor, endpoint)
+        , admission_(admission)
     {
-        socket_manager.del(this);
+        set_admission(admission);
     }
 
-    void do_send()
+    void check_timeout()
     {
-        if(send_buffers_.front() == 0 || is_closed())
-            return;
-
-        int ec;
-        size_t bytes;
-        send_buffers_helper_.resize(send_buffers_.size());
-        auto bh = send_buffers_helper_.begin();
-        auto buf = send_buffers_.front();
-        socket_ops::init_buf(*bh, buf->data + send_buffer_offset_, buf->size - send_buffer_offset_);
-        ++bh;
-        buf = buf->next_;
-        while(buf)
-        {
-            socket_ops::init_buf(*bh, buf->data, buf->size);
-			buf = buf->next_;
-            ++bh;
-        }
-
-        bool complete = socket_ops::non_blocking_send(handle(), &send_buffers_helper_[0], send_buffers_helper_.size(), 0, ec, bytes);
-        if(complete && ec)
+        MonoTime now = get_reactor().now();
+        pool().for_each([&](EchoSocket & s)
         {
-			Logger::debug() << "socket send err(" << ec << "): " << strerror(ec) ; 
-            close();
-            return;
-        }
-
-        buf = send_buffers_.front();
-
-        if(bytes >= buf->size - send_buffer_offset_)
-        {
-            bytes -= buf->size - send_buffer_offset_;
-			Buffer *tmp = buf;
-			send_buffers_.pop();
-            free_buffer(tmp);
-            buf = send_buffers_.front();
-            while(buf)
+            if(s.check_timeout(now))
             {
-                if(bytes >= buf->size)
-                {
-                    bytes -= buf->size;
-					Buffer *tmp = buf;
-					send_buffers_.pop();
-                    free_buffer(tmp);
-                    buf = send_buffers_.front();
-                }
-                else
-                {
-                    send_buffer_offset_ = bytes;
-                    break;
-                }
+                LOG_DEBUG << "socket timeout: " << s.handle() ;
+                s.close();
             }
-        }
-        else
-        {
-            send_buffer_offset_ += bytes;
-        }
-    }
-
-	Queue<Buffer> send_buffers_;
-    size_t send_buffers_size_;
-    size_t send_buffer_offset_;
-    std::vector<socket_ops::buf> send_buffers_helper_;
-    time_t timestamp_;
-};
-
-
-void EchoSocketManager::add(EchoSocket *s)
-{
-#ifdef __DEBUG__
-    Logger::debug() << "add socket: " << s->handle() ;
-#endif
-    sockets_.insert(s);
-}
-
-void EchoSocketManager::del(EchoSocket *s)
-{
-#ifdef __DEBUG__
-        Logger::debug() << "del socket: " << s->handle() ;
-#endif
-        sockets_.erase(s);
-        delete s;
-}
-
-void EchoSocketManager::check_timeout()
-{
-    auto now = std::time(0);
-    for(auto i = sockets_.begin(); i != sockets_.end();)
-    {
-        if((*i)->check_timeout(now))
-        {
-#ifdef __DEBUG__
-            Logger::debug() << "socket timeout: " << (*i)->handle() ;
-#endif
-            delete *i;
-            i = sockets_.erase(i);
-        }
-        else
-        {
-            ++i;
-        }
+        });
     }
-}
 
-class EchoAcceptor : public tcp::Acceptor
-{
-public:
-    EchoAcceptor(Reactor & reactor, const tcp::Endpoint & endpoint)
-        : Acceptor(reactor, endpoint)
-    {
-    }
 protected:
-    void handle_events(Event event)
+    EchoSocket * create_socket(int sock)
     {
-        if(event | EPOLLIN)
-        {
-            while(true)
-            {
-                int sock = accept(handle(), 0, 0);
-                if(sock != -1)
-                {
-                    socket_manager.add(new EchoSocket(get_reactor(), sock));
-                }
-                else
-                    break;
-            }
-        }
+        return pool().create(get_reactor(), sock, pool(), admission_, tcp::Admission::key(peer()));
     }
+
+private:
+    tcp::Admission * admission_;
 };
 
 class EchoTimer : public DeadlineTimer
 {
 public:
-    EchoTimer(Reactor & reactor)
+    EchoTimer(Reactor & reactor, EchoAcceptor & acceptor, tcp::MetricsServer & metrics)
         : DeadlineTimer(reactor)
+        , acceptor_(acceptor)
+        , metrics_(metrics)
+        , last_reads_(0)
+        , last_writes_(0)
     {
         this->set_interval(1);
     }
@@ -328,31 +180,93 @@ protected:
             while((exp = read(handle(), &exp, sizeof(exp))) == sizeof(exp))
             {
                 //Logger::debug() << "tick..";
-                socket_manager.check_timeout();
-				uint64_t c1 = read_event_count;
-				uint64_t c2 = write_event_count;
+                acceptor_.check_timeout();
+                acceptor_.update_filter();
+                LogLimiter::flush_suppressed();
+                metrics_.check_timeout(acceptor_.get_reactor().now());
+				uint64_t c1 = read_events.value() - last_reads_;
+				uint64_t c2 = write_events.value() - last_writes_;
 				Logger::debug() << "process event (read: " << c1 << ", write: " << c2 << ")";
-				read_event_count = 0;
-				write_event_count = 0;
+				last_reads_ += c1;
+				last_writes_ += c2;
             }
         }
     }
+
+private:
+    EchoAcceptor & acceptor_;
+    tcp::MetricsServer & metrics_;
+    uint64_t last_reads_;
+    uint64_t last_writes_;
 };
 
 int main(int argc, char *argv[])
 {
+    AsyncLogger::start(STDOUT_FILENO);
     try
     {
+        std::unique_ptr<TraceRecorder> recorder;
         Reactor reactor;
+        // ECHO_PROFILE=<us> times the handlers and reports those slower than us.
+        if(const char * slow = std::getenv("ECHO_PROFILE"))
+            reactor.set_profiling(true, std::atoi(slow));
+        // ECHO_TRACE=<path> records the traffic for trace_replay.
+        if(const char * trace = std::getenv("ECHO_TRACE"))
+        {
+            recorder.reset(new TraceRecorder(trace));
+            reactor.set_recorder(recorder.get());
+        }
+        // echo_server_tcp [ip port | unix-socket-path]
         tcp::Endpoint endpoint("0.0.0.0", 20000);
-        EchoAcceptor acceptor(reactor, endpoint);
-        EchoTimer timer(reactor);
+        if(argc == 2)
+            endpoint = tcp::Endpoint::local(argv[1]);
+        else if(argc == 3)
+            endpoint = tcp::Endpoint(argv[1], std::atoi(argv[2]));
+        // ECHO_ACCEPT_RATE=<n> accepts n connections per second, and
+        // ECHO_SOURCE_LIMIT=<n> n per source address at a time; sources
+        // rejected 100 times in a row are blocked for a minute.
+        std::unique_ptr<tcp::Admission> admission;
+        const char * rate = std::getenv("ECHO_ACCEPT_RATE");
+        const char * source_limit = std::getenv("ECHO_SOURCE_LIMIT");
+        if(rate || source_limit)
+        {
+            tcp::Admission::Limits limits;
+            if(rate)
+            {
+                limits.rate = std::atof(rate);
+                limits.burst = limits.rate / 10 + 1;
+            }
+            if(source_limit)
+            {
+                limits.source_connections = std::atoi(source_limit);
+                limits.block_after = 100;
+            }
+            admission.reset(new tcp::Admission(limits));
+        }
+        EchoAcceptor acceptor(reactor, endpoint, admission.get());
+        // Metrics are served next to the echo port, e.g.
+        //   curl http://127.0.0.1:20001/metrics
+        tcp::MetricsServer metrics(reactor, tcp::Endpoint("127.0.0.1", 20001));
+        Metrics::set_thread_name("reactor");
+        // Stop reading from a client with 1 MB of echo waiting for it, and
+        // from all that have some once 256 MB wait in total.
+        Memory::set_connection_budget(1 << 20);
+        tcp::Socket::set_send_limit(256 << 20);
+        // ECHO_MEMORY_MB=<n> sheds connections and reads beyond n MB.
+        if(const char * mb = std::getenv("ECHO_MEMORY_MB"))
+            Memory::set_budget(size_t(std::atoi(mb)) << 20);
+        PoolTrimmer trimmer(reactor);
+        EchoTimer timer(reactor, acceptor, metrics);
+        Watchdog watchdog;
+        watchdog.watch(reactor);
+        watchdog.start();
         reactor.run();
     }
     catch(const SystemException & err)
     {
         Logger::debug() << err.ec() << "," << err.what();
     }
+    AsyncLogger::stop();
 
     return 0;
 }
@@ -1,6 +1,4 @@
 #include <list>
-#include <unordered_set>
-#include <vector>
 #include <sys/epoll.h>
 #include <unistd.h>
 #include <stdio.h>
@@ -9,11 +7,12 @@
 #include "udp/socket.h"
 #include "udp/endpoint.h"
 
+#include "connectiontable.h"
 #include "deadlinetimer.h"
 #include "systemexception.h"
 #include "socketops.h"
 #include "queue.h"
-#include "objectpool.h"
+#include "buffer.h"
 
 using namespace detail;
 
@@ -22,44 +21,17 @@ class EchoSocket;
 class EchoSocketManager
 {
 public:
-    void add(EchoSocket *s);
+    void add(Reactor & reactor, const udp::Endpoint & ep);
 
     void del(EchoSocket *s);
 
 private:
-    std::unordered_set<EchoSocket *> sockets_;
+    // One socket, with a 64KB buffer, per slab.
+    ConnectionTable<EchoSocket, 1> sockets_;
 };
 
 EchoSocketManager socket_manager;
 
-class Buffer : private Noncopyable
-{
-    friend class detail::QueueAccess;
-    friend class detail::ObjectPoolAccess;
-public:
-    Buffer()
-        :size(0)
-    {
-    }
-
-    void destroy();
-
-    enum { max_size = 256, };
-    char data[max_size];
-
-    Buffer * next_;
-    Buffer * prev;
-    Buffer * next;
-    size_t size;
-};
-
-ObjectPool<Buffer> buffer_pool;
-
-void Buffer::destroy()
-{
-    buffer_pool.free(this);
-}
-
 class EchoSocket : public udp::Socket
 {
     enum { max_send_size = 256, };
@@ -82,35 +54,30 @@ protected:
         {
             int ec;
             size_t bytes;
-            size_t addrlen = 0;
 
+            // Echo each datagram to its sender; a reply that does not fit in
+            // the send buffer is dropped. Drive it with
+            // udp_bench -h 127.0.0.1 -p 60000 -m recvfrom.
             while(true)
             {
-                Buffer *b = alloc_buffer();
+                sockaddr_storage addr;
+                size_t addrlen = sizeof(addr);
                 socket_ops::buf buf;
-                socket_ops::init_buf(buf, b->data, b->max_size);
-                bool ret = socket_ops::non_blocking_recvfrom(handle(), &buf, 1, 0, 0, &addrlen, ec, bytes);
+                socket_ops::init_buf(buf, data_, sizeof(data_));
+                bool ret = socket_ops::non_blocking_recvfrom(handle(), &buf, 1, 0,
+                    (socket_ops::socket_addr_type *)&addr, &addrlen, ec, bytes);
                 if(ret == false)
-                {
-                    free_buffer(b);
                     break;
-                }
 
                 if(ec)
                 {
-                    free_buffer(b);
                     close();
                     return;
                 }
-                b->size = bytes;
-                
-                printf("size %d: ", (int)b->size);
-                for(size_t i = 0; i < b->size; ++i)
-                {
-                    if(i%15 == 0)
-                        printf("\n");
-                    printf("%2x", 0xFF & b->data[i]);
-                }
+
+                socket_ops::init_buf(buf, data_, bytes);
+                socket_ops::sendto(handle(), &buf, 1, 0,
+                    (socket_ops::socket_addr_type *)&addr, addrlen, ec);
             }
         }
 
@@ -125,17 +92,6 @@ protected:
     }
 
 private:
-	Buffer * alloc_buffer()
-    {
-        return buffer_pool.alloc();
-    }
-
-	void free_buffer(Buffer * b)
-    {
-        buffer_pool.free(b);
-        //delete b;
-	}
-
     void close()
     {
         socket_manager.del(this);
@@ -147,25 +103,20 @@ private:
     }
 
 	Queue<Buffer> send_buffers_;
-    std::vector<socket_ops::buf> send_buffers_helper_;
+    char data_[65536];
 };
 
 
-void EchoSocketManager::add(EchoSocket *s)
+void EchoSocketManager::add(Reactor & reactor, const udp::Endpoint & ep)
 {
-#ifdef __DEBUG__
-    Logger::debug() << "add socket: " << s->handle() ;
-#endif
-    sockets_.insert(s);
+    EchoSocket * s = sockets_.emplace(reactor, ep);
+    LOG_DEBUG << "add socket: " << s->handle() ;
 }
 
 void EchoSocketManager::del(EchoSocket *s)
 {
-#ifdef __DEBUG__
-        Logger::debug() << "del socket: " << s->handle() ;
-#endif
+        LOG_DEBUG << "del socket: " << s->handle() ;
         sockets_.erase(s);
-        delete s;
 }
 
 int main(int argc, char *argv[])
@@ -174,7 +125,7 @@ int main(int argc, char *argv[])
     {
         Reactor reactor;
         udp::Endpoint endpoint("0.0.0.0", 60000);
-        EchoSocket socket(reactor, endpoint);
+        socket_manager.add(reactor, endpoint);
         reactor.run();
     }
     catch(const SystemException & err)
@@ -0,0 +1,211 @@
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <string>
+#include <stdint.h>
+
+#include "logger.h"
+#include "deferredlog.h"
+
+// Turns a binary AsyncLogger file back into text lines:
+//   log_decode <file>
+
+namespace
+{
+
+const uint32_t text_record = 0;
+const uint32_t definition_record = 0xffffffff;
+
+struct Definition
+{
+    int32_t level;
+    int32_t line;
+    std::string file;
+    std::string fmt;
+};
+
+template <typename T>
+bool read(const char *& p, const char * end, T & value)
+{
+    if(p + sizeof(T) > end)
+        return false;
+    std::memcpy(&value, p, sizeof(T));
+    p += sizeof(T);
+    return true;
+}
+
+bool read_string(const char *& p, const char * end, std::string & s)
+{
+    uint16_t size;
+    if(!read(p, end, size) || p + size > end)
+        return false;
+    s.assign(p, size);
+    p += size;
+    return true;
+}
+
+// Format the next encoded argument.
+bool format_arg(const char *& p, const char * end, std::string & out)
+{
+    char type;
+    if(!read(p, end, type))
+        return false;
+
+    char buf[64];
+    switch(type)
+    {
+    case detail::DeferredLog::int_arg:
+    {
+        int64_t v;
+        if(!read(p, end, v))
+            return false;
+        std::snprintf(buf, sizeof(buf), "%lld", (long long)v);
+        break;
+    }
+    case detail::DeferredLog::uint_arg:
+    {
+        uint64_t v;
+        if(!read(p, end, v))
+            return false;
+        std::snprintf(buf, sizeof(buf), "%llu", (unsigned long long)v);
+        break;
+    }
+    case detail::DeferredLog::double_arg:
+    {
+        double v;
+        if(!read(p, end, v))
+            return false;
+        std::snprintf(buf, sizeof(buf), "%g", v);
+        break;
+    }
+    case detail::DeferredLog::pointer_arg:
+    {
+        uint64_t v;
+        if(!read(p, end, v))
+            return false;
+        std::snprintf(buf, sizeof(buf), "0x%llx", (unsigned long long)v);
+        break;
+    }
+    case detail::DeferredLog::string_arg:
+    {
+        std::string s;
+        if(!read_string(p, end, s))
+            return false;
+        out += s;
+        return true;
+    }
+    default:
+        return false;
+    }
+    out += buf;
+    return true;
+}
+
+std::string format_time(uint64_t ns)
+{
+    time_t sec = ns / 1000000000;
+    tm t;
+    localtime_r(&sec, &t);
+    char buf[64];
+    size_t n = std::strftime(buf, sizeof(buf), "%F %T", &t);
+    std::snprintf(buf + n, sizeof(buf) - n, ".%06u", (unsigned)(ns % 1000000000 / 1000));
+    return buf;
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    if(argc != 2)
+    {
+        std::fprintf(stderr, "usage: %s <binary log>\n", argv[0]);
+        return 1;
+    }
+
+    std::ifstream in(argv[1], std::ios::binary);
+    std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    if(data.compare(0, 8, "RLOGBIN1") != 0)
+    {
+        std::fprintf(stderr, "%s: not a binary log\n", argv[1]);
+        return 1;
+    }
+
+    // Definitions may follow the first records using them, so collect them
+    // before printing.
+    std::map<uint32_t, Definition> definitions;
+    const char * begin = data.data() + 8;
+    const char * end = data.data() + data.size();
+    for(const char * p = begin; p < end;)
+    {
+        uint32_t size, id;
+        uint64_t time;
+        const char * q = p;
+        if(!read(q, end, size) || q + size > end)
+            break;
+        const char * record_end = q + size;
+        p = record_end;
+        if(!read(q, record_end, id) || !read(q, record_end, time) || id != definition_record)
+            continue;
+
+        uint32_t def_id;
+        Definition def;
+        if(read(q, record_end, def_id) && read(q, record_end, def.level) && read(q, record_end, def.line)
+           && read_string(q, record_end, def.file) && read_string(q, record_end, def.fmt))
+            definitions[def_id] = def;
+    }
+
+    for(const char * p = begin; p < end;)
+    {
+        uint32_t size, id;
+        uint64_t time;
+        const char * q = p;
+        if(!read(q, end, size) || q + size > end)
+        {
+            std::fprintf(stderr, "truncated record\n");
+            break;
+        }
+        const char * record_end = q + size;
+        p = record_end;
+        if(!read(q, record_end, id) || !read(q, record_end, time))
+            continue;
+
+        if(id == definition_record)
+            continue;
+
+        if(id == text_record)
+        {
+            std::printf("%s %.*s\n", format_time(time).c_str(), (int)(record_end - q), q);
+            continue;
+        }
+
+        auto def = definitions.find(id);
+        if(def == definitions.end())
+        {
+            std::printf("%s <unknown format %u>\n", format_time(time).c_str(), id);
+            continue;
+        }
+
+        std::string line = Logger::prefix(static_cast<Logger::Level>(def->second.level));
+        const std::string & fmt = def->second.fmt;
+        size_t pos = 0;
+        for(;;)
+        {
+            size_t mark = fmt.find("{}", pos);
+            if(mark == std::string::npos || q >= record_end)
+            {
+                line.append(fmt, pos, std::string::npos);
+                break;
+            }
+            line.append(fmt, pos, mark - pos);
+            if(!format_arg(q, record_end, line))
+                break;
+            pos = mark + 2;
+        }
+        std::printf("%s %s\n", format_time(time).c_str(), line.c_str());
+    }
+
+    return 0;
+}
@@ -0,0 +1,192 @@
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "asynclogger.h"
+#include "deferredlog.h"
+
+// Checks that AsyncLogger writes every line when more threads log at once
+// than the writer gathers into one writev. All threads append one line at
+// the same moment and keep their rings until the writer drained them, so
+// one drain sees every ring; the log file must then hold each line once.
+//
+// Then checks deferred logging: LOG_DEFERRED records with mixed argument
+// types are written in binary format and must come back from log_decode,
+// which is expected next to this program, as the lines formatted in place.
+// Exits with 1 when a line is missing, repeated or decoded wrong.
+//
+//   logger_check [threads]
+
+namespace
+{
+
+int make_temp(char * path)
+{
+    int fd = ::mkstemp(path);
+    if(fd == -1)
+        std::perror("mkstemp");
+    return fd;
+}
+
+int check_deferred(const std::string & decoder)
+{
+    char path[] = "/tmp/logger_check.XXXXXX";
+    int fd = make_temp(path);
+    if(fd == -1)
+        return 2;
+    AsyncLogger::start(fd, AsyncLogger::block, 1 << 18, AsyncLogger::binary);
+
+    const void * ptr = reinterpret_cast<const void *>(uintptr_t(0xbeef));
+    std::string name("pool");
+    LOG_DEFERRED(Logger::warn_level, "no arguments");
+    LOG_DEFERRED(Logger::warn_level, "int {} uint {} char {} bool {}", -42, 7u, 'x', true);
+    LOG_DEFERRED(Logger::warn_level, "double {} pointer {} end", 2.5, ptr);
+    LOG_DEFERRED(Logger::warn_level, "{} and {}: {} left", "text", name, uint64_t(1) << 40);
+    LOG_DEFERRED(Logger::warn_level, "missing {} {}", -1);
+    AsyncLogger::stop();
+    ::close(fd);
+
+    std::string prefix = Logger::prefix(Logger::warn_level);
+    const char * expected[] =
+    {
+        "no arguments",
+        "int -42 uint 7 char 120 bool 1",
+        "double 2.5 pointer 0xbeef end",
+        "text and pool: 1099511627776 left",
+        "missing -1 {}",
+    };
+    const int count = sizeof(expected) / sizeof(expected[0]);
+
+    std::string command = decoder + " " + path;
+    FILE * out = ::popen(command.c_str(), "r");
+    if(!out)
+    {
+        std::perror("popen");
+        ::unlink(path);
+        return 2;
+    }
+    // Each line is the time, date and clock, then the formatted record.
+    char line[1024];
+    int n = 0;
+    int bad = 0;
+    while(std::fgets(line, sizeof(line), out))
+    {
+        std::string text(line);
+        if(!text.empty() && text[text.size() - 1] == '\n')
+            text.erase(text.size() - 1);
+        size_t pos = text.find(' ');
+        pos = pos == std::string::npos ? pos : text.find(' ', pos + 1);
+        text = pos == std::string::npos ? "" : text.substr(pos + 1);
+        if(n >= count || text != prefix + expected[n])
+        {
+            std::printf("deferred line %d: \"%s\"\n", n, text.c_str());
+            ++bad;
+        }
+        ++n;
+    }
+    int status = ::pclose(out);
+    ::unlink(path);
+    if(status != 0 || n != count)
+    {
+        std::printf("%s: exit status %d, %d of %d lines\n", decoder.c_str(), status, n, count);
+        ++bad;
+    }
+    std::printf("%d deferred lines, %d wrong\n", count, bad);
+    return bad ? 1 : 0;
+}
+
+}
+
+int main(int argc, char * argv[])
+{
+    int threads = argc > 1 ? std::atoi(argv[1]) : 48;
+    if(threads <= 0)
+    {
+        std::fprintf(stderr, "usage: logger_check [threads]\n");
+        return 2;
+    }
+
+    char path[] = "/tmp/logger_check.XXXXXX";
+    int fd = make_temp(path);
+    if(fd == -1)
+        return 2;
+    ::unlink(path);
+    AsyncLogger::start(fd, AsyncLogger::block);
+
+    std::atomic<int> ready(0);
+    std::atomic<bool> go(false);
+    std::atomic<int> logged(0);
+    std::atomic<bool> done(false);
+    std::vector<std::thread> workers;
+    for(int i = 0; i < threads; ++i)
+    {
+        workers.emplace_back([&, i]() {
+            std::string line = "thread " + std::to_string(i);
+            ready.fetch_add(1);
+            while(!go.load())
+                std::this_thread::yield();
+            AsyncLogger::append(line.data(), line.size());
+            logged.fetch_add(1);
+            while(!done.load())
+                std::this_thread::yield();
+        });
+    }
+
+    while(ready.load() < threads)
+        std::this_thread::yield();
+    go.store(true);
+    while(logged.load() < threads)
+        std::this_thread::yield();
+    // The writer drains every 10 ms; give it a round with all rings live.
+    ::usleep(50000);
+    done.store(true);
+    for(std::thread & t : workers)
+        t.join();
+    AsyncLogger::stop();
+
+    std::vector<int> seen(threads);
+    std::string data;
+    char buf[4096];
+    ssize_t n;
+    ::lseek(fd, 0, SEEK_SET);
+    while((n = ::read(fd, buf, sizeof(buf))) > 0)
+        data.append(buf, n);
+    ::close(fd);
+
+    size_t pos = 0;
+    while(pos < data.size())
+    {
+        size_t end = data.find('\n', pos);
+        if(end == std::string::npos)
+            end = data.size();
+        int i;
+        if(std::sscanf(data.c_str() + pos, "thread %d", &i) == 1 && i >= 0 && i < threads)
+            ++seen[i];
+        pos = end + 1;
+    }
+
+    int bad = 0;
+    for(int i = 0; i < threads; ++i)
+    {
+        if(seen[i] != 1)
+        {
+            std::printf("thread %d: line written %d times\n", i, seen[i]);
+            ++bad;
+        }
+    }
+    std::printf("%d threads, %d lines wrong\n", threads, bad);
+
+    std::string self(argv[0]);
+    size_t slash = self.rfind('/');
+    std::string decoder = (slash == std::string::npos ? std::string(".") : self.substr(0, slash)) + "/log_decode";
+    int deferred = check_deferred(decoder);
+    if(deferred == 2)
+        return 2;
+    return bad || deferred ? 1 : 0;
+}
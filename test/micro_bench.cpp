@@ -0,0 +1,357 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <getopt.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "reactor.h"
+#include "socketops.h"
+#include "objectpool.h"
+#include "queue.h"
+#include "systemexception.h"
+
+// Microbenchmarks of the core primitives. Each benchmark runs once to warm
+// up and then -r times on the CPU the process is pinned to; the median,
+// fastest and slowest run are reported in nanoseconds per operation.
+//
+//   micro_bench [-c cpu] [-r repetitions] [-f filter] [-j]
+//
+// -f runs the benchmarks whose name contains filter, -j prints one JSON
+// object per benchmark.
+
+using namespace detail;
+
+namespace
+{
+
+int repetitions = 7;
+std::string filter;
+bool json = false;
+
+uint64_t now_ns()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+// Keeps the compiler from dropping a computation whose result is unused.
+template <typename T>
+void keep(T const & value)
+{
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+// body runs ops operations per call.
+void run(const char * name, uint64_t ops, const std::function<void()> & body)
+{
+    if(!filter.empty() && std::string(name).find(filter) == std::string::npos)
+        return;
+
+    body();
+
+    std::vector<double> results;
+    for(int i = 0; i < repetitions; ++i)
+    {
+        uint64_t start = now_ns();
+        body();
+        results.push_back(double(now_ns() - start) / ops);
+    }
+    std::sort(results.begin(), results.end());
+    double median = results[results.size() / 2];
+
+    if(json)
+        std::printf("{\"name\":\"%s\",\"ns_per_op\":%.2f,\"min\":%.2f,\"max\":%.2f,\"repetitions\":%d}\n",
+                    name, median, results.front(), results.back(), repetitions);
+    else
+        std::printf("%-32s %10.2f ns/op   min %10.2f   max %10.2f\n",
+                    name, median, results.front(), results.back());
+}
+
+// Element usable with both ObjectPool and Queue.
+struct Node
+{
+    Node * next_;
+    Node * next;
+    Node * prev;
+    uint64_t payload;
+
+    void destroy() { }
+};
+
+void bench_object_pool()
+{
+    const int n = 1 << 20;
+
+    run("object_pool/hot", n, [&]
+    {
+        ObjectPool<Node> pool;
+        pool.free(pool.alloc());
+        for(int i = 0; i < n; ++i)
+        {
+            Node * o = pool.alloc();
+            keep(o);
+            pool.free(o);
+        }
+    });
+
+    // Every alloc comes from an empty free list and so from new.
+    const int cold = 1 << 16;
+    run("object_pool/cold", cold, [&]
+    {
+        ObjectPool<Node> pool;
+        for(int i = 0; i < cold; ++i)
+            keep(pool.alloc());
+    });
+
+    // A burst like Socket::receive: take 64, give them back.
+    run("object_pool/batch64", n, [&]
+    {
+        ObjectPool<Node> pool;
+        Node * batch[64];
+        for(int i = 0; i < n; i += 64)
+        {
+            for(int j = 0; j < 64; ++j)
+                batch[j] = pool.alloc();
+            for(int j = 0; j < 64; ++j)
+                pool.free(batch[j]);
+        }
+    });
+}
+
+void bench_queue()
+{
+    const int n = 1 << 20;
+    std::vector<Node> nodes(64);
+
+    run("queue/push_pop", n, [&]
+    {
+        Queue<Node> q;
+        for(int i = 0; i < n; i += 64)
+        {
+            for(Node & node : nodes)
+                q.push(&node);
+            while(Node * node = q.front())
+            {
+                keep(node);
+                q.pop();
+            }
+        }
+    });
+
+    run("queue/splice", n, [&]
+    {
+        Queue<Node> a, b;
+        for(Node & node : nodes)
+            a.push(&node);
+        for(int i = 0; i < n; i += 2)
+        {
+            b.push(a);
+            a.push(b);
+        }
+        while(a.front())
+            a.pop();
+    });
+}
+
+class EventFdHandler : public EventHandler
+{
+public:
+    EventFdHandler(Reactor & reactor, uint64_t & budget)
+        : reactor_(reactor)
+        , budget_(budget)
+        , fd_(::eventfd(1, EFD_NONBLOCK | EFD_CLOEXEC))
+    {
+        if(fd_ == -1)
+            throw_error(errno, "eventfd");
+    }
+
+    ~EventFdHandler()
+    {
+        ::close(fd_);
+    }
+
+    virtual Handle handle() { return fd_; }
+
+    // Level triggered and never read, so the handler fires every wakeup.
+    void handle_events(Event events)
+    {
+        if(--budget_ == 0)
+            reactor_.stop();
+    }
+
+private:
+    Reactor & reactor_;
+    uint64_t & budget_;
+    int fd_;
+};
+
+class PairHandler : public EventHandler
+{
+public:
+    PairHandler(Reactor & reactor, uint64_t & budget)
+        : reactor_(reactor)
+        , budget_(budget)
+    {
+        if(::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, fds_) == -1)
+            throw_error(errno, "socketpair");
+        char c = 'x';
+        if(::write(fds_[1], &c, 1) != 1)
+            throw_error(errno, "write");
+    }
+
+    ~PairHandler()
+    {
+        ::close(fds_[0]);
+        ::close(fds_[1]);
+    }
+
+    virtual Handle handle() { return fds_[0]; }
+
+    void handle_events(Event events)
+    {
+        if(--budget_ == 0)
+            reactor_.stop();
+    }
+
+private:
+    Reactor & reactor_;
+    uint64_t & budget_;
+    int fds_[2];
+};
+
+template <typename Handler>
+void bench_dispatch(const char * name, int handlers)
+{
+    const uint64_t n = 1 << 20;
+    uint64_t budget = 0;
+    Reactor reactor;
+    std::vector<Handler *> hs;
+    for(int i = 0; i < handlers; ++i)
+    {
+        hs.push_back(new Handler(reactor, budget));
+        reactor.register_handle(hs.back(), EPOLLIN);
+    }
+
+    run(name, n, [&]
+    {
+        budget = n;
+        reactor.run();
+    });
+
+    for(Handler * h : hs)
+    {
+        reactor.deregister_handle(h);
+        delete h;
+    }
+}
+
+void bench_reactor()
+{
+    const int n = 1 << 18;
+    {
+        uint64_t budget = 0;
+        Reactor reactor;
+        EventFdHandler h(reactor, budget);
+        run("reactor/register_deregister", n, [&]
+        {
+            for(int i = 0; i < n; ++i)
+            {
+                reactor.register_handle(&h, EPOLLIN | EPOLLET);
+                reactor.deregister_handle(&h);
+            }
+        });
+    }
+
+    bench_dispatch<EventFdHandler>("reactor/dispatch_eventfd_1", 1);
+    bench_dispatch<EventFdHandler>("reactor/dispatch_eventfd_64", 64);
+    bench_dispatch<PairHandler>("reactor/dispatch_socketpair_64", 64);
+}
+
+void bench_socket_ops()
+{
+    const int n = 1 << 18;
+    int fds[2];
+    if(::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, fds) == -1)
+        throw_error(errno, "socketpair");
+
+    char out[64];
+    char in[64];
+    std::memset(out, 'x', sizeof(out));
+
+    run("socket_ops/send_recv_64", n, [&]
+    {
+        for(int i = 0; i < n; ++i)
+        {
+            int ec;
+            size_t bytes;
+            socket_ops::buf b;
+            socket_ops::init_buf(b, out, sizeof(out));
+            socket_ops::non_blocking_send(fds[1], &b, 1, 0, ec, bytes);
+            socket_ops::init_buf(b, in, sizeof(in));
+            socket_ops::non_blocking_recv(fds[0], &b, 1, 0, true, ec, bytes);
+            keep(bytes);
+        }
+    });
+
+    run("syscall/send_recv_64", n, [&]
+    {
+        for(int i = 0; i < n; ++i)
+        {
+            ssize_t bytes = ::send(fds[1], out, sizeof(out), MSG_NOSIGNAL);
+            bytes = ::recv(fds[0], in, sizeof(in), 0);
+            keep(bytes);
+        }
+    });
+
+    ::close(fds[0]);
+    ::close(fds[1]);
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    int cpu = -1;
+    int opt;
+    while((opt = ::getopt(argc, argv, "c:r:f:j")) != -1)
+    {
+        switch(opt)
+        {
+        case 'c': cpu = std::atoi(optarg); break;
+        case 'r': repetitions = std::max(1, std::atoi(optarg)); break;
+        case 'f': filter = optarg; break;
+        case 'j': json = true; break;
+        default:
+            std::fprintf(stderr, "usage: %s [-c cpu] [-r repetitions] [-f filter] [-j]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    // Stay on one CPU so caches and frequency do not change under a run.
+    if(cpu < 0)
+        cpu = ::sched_getcpu();
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if(::sched_setaffinity(0, sizeof(set), &set) == -1)
+        std::perror("sched_setaffinity");
+    if(!json)
+        std::printf("pinned to cpu %d, %d repetitions\n", cpu, repetitions);
+
+    bench_object_pool();
+    bench_queue();
+    bench_reactor();
+    bench_socket_ops();
+
+    return 0;
+}
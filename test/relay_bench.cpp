@@ -0,0 +1,304 @@
+#include <thread>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include "logger.h"
+#include "tcp/socket.h"
+#include "tcp/relay.h"
+#include "systemexception.h"
+#include "socketops.h"
+#include "error.h"
+#include "queue.h"
+#include "buffer.h"
+
+// Pushes a fixed amount of data client -> relay -> backend over loopback and
+// compares the splice relay with a read/write relay built like the echo
+// server, reporting throughput and CPU time of the relay thread.
+
+using namespace detail;
+
+int listen_loopback(unsigned short & port)
+{
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if(::bind(fd, (sockaddr *)&addr, len) == -1 || ::listen(fd, 16) == -1)
+        throw_error(errno, "listen");
+    ::getsockname(fd, (sockaddr *)&addr, &len);
+    port = ntohs(addr.sin_port);
+    return fd;
+}
+
+int connect_loopback(unsigned short port)
+{
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if(::connect(fd, (sockaddr *)&addr, sizeof(addr)) == -1)
+        throw_error(errno, "connect");
+    return fd;
+}
+
+class SpliceRelay : public tcp::Relay
+{
+public:
+    SpliceRelay(Reactor & reactor, int client, int backend)
+        : Relay(reactor, client, backend)
+        , reactor_(reactor)
+    {
+    }
+
+protected:
+    void handle_close(int ec)
+    {
+        if(ec)
+            Logger::error() << "relay err(" << ec << "): " << strerror(ec);
+        reactor_.stop();
+    }
+
+private:
+    Reactor & reactor_;
+};
+
+class CopyRelay;
+
+class CopySocket : public tcp::Socket
+{
+public:
+    CopySocket(Reactor & reactor, int sockfd, CopyRelay * relay)
+        : Socket(reactor, sockfd)
+        , relay_(relay)
+        , peer_(0)
+        , eof_(false)
+        , shutdown_(false)
+    {
+    }
+
+    void set_peer(CopySocket * peer) { peer_ = peer; }
+
+    bool done() { return eof_ && peer_->shutdown_; }
+
+protected:
+    void handle_events(Event event);
+
+private:
+    void shutdown_if_drained()
+    {
+        if(peer_->eof_ && !shutdown_ && send_queue_size() == 0)
+        {
+            int ec;
+            socket_ops::shutdown(handle(), SHUT_WR, ec);
+            shutdown_ = true;
+        }
+    }
+
+    CopyRelay * relay_;
+    CopySocket * peer_;
+    bool eof_;
+    bool shutdown_;
+};
+
+class CopyRelay
+{
+public:
+    CopyRelay(Reactor & reactor, int client, int backend)
+        : reactor_(reactor)
+        , client_(reactor, client, this)
+        , backend_(reactor, backend, this)
+    {
+        client_.set_peer(&backend_);
+        backend_.set_peer(&client_);
+    }
+
+    void check_done()
+    {
+        if(client_.done() && backend_.done())
+            reactor_.stop();
+    }
+
+    void fail(int ec)
+    {
+        Logger::error() << "relay err(" << ec << "): " << strerror(ec);
+        reactor_.stop();
+    }
+
+private:
+    Reactor & reactor_;
+    CopySocket client_;
+    CopySocket backend_;
+};
+
+void CopySocket::handle_events(Event event)
+{
+    if(event & EPOLLIN)
+    {
+        int ec;
+        size_t bytes;
+        Queue<Buffer> bufs;
+
+        while(!eof_)
+        {
+            Buffer *b = Buffer::alloc();
+            socket_ops::buf buf;
+            socket_ops::init_buf(buf, b->data, b->max_size);
+            bool ret = socket_ops::non_blocking_recv(handle(), &buf, 1, 0, true, ec, bytes);
+            if(ret == false)
+            {
+                b->destroy();
+                break;
+            }
+
+            if(ec == detail::error::eof)
+            {
+                b->destroy();
+                eof_ = true;
+                break;
+            }
+
+            if(ec)
+            {
+                b->destroy();
+                relay_->fail(ec);
+                return;
+            }
+
+            b->size = bytes;
+            bufs.push(b);
+        }
+
+        ec = peer_->send(bufs);
+        if(ec)
+        {
+            relay_->fail(ec);
+            return;
+        }
+        peer_->shutdown_if_drained();
+    }
+
+    if(event & EPOLLOUT)
+    {
+        int ec = flush();
+        if(ec)
+        {
+            relay_->fail(ec);
+            return;
+        }
+        shutdown_if_drained();
+    }
+
+    relay_->check_done();
+}
+
+struct Result
+{
+    double seconds;
+    double cpu_seconds;
+};
+
+double thread_cpu_seconds()
+{
+    rusage ru;
+    ::getrusage(RUSAGE_THREAD, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec
+        + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+template <typename RelayType>
+Result run(size_t total)
+{
+    unsigned short front_port, backend_port;
+    int front = listen_loopback(front_port);
+    int backend = listen_loopback(backend_port);
+
+    std::thread source([&]() {
+        int fd = connect_loopback(front_port);
+        static char data[1 << 16];
+        size_t sent = 0;
+        while(sent < total)
+        {
+            ssize_t n = ::write(fd, data, std::min(sizeof(data), total - sent));
+            if(n <= 0)
+                break;
+            sent += n;
+        }
+        ::shutdown(fd, SHUT_WR);
+        char c;
+        while(::read(fd, &c, 1) > 0)
+            ;
+        ::close(fd);
+    });
+
+    size_t received = 0;
+    std::thread sink([&]() {
+        int fd = ::accept(backend, 0, 0);
+        static char data[1 << 16];
+        ssize_t n;
+        while((n = ::read(fd, data, sizeof(data))) > 0)
+            received += n;
+        ::close(fd);
+    });
+
+    int client = ::accept(front, 0, 0);
+    int upstream = connect_loopback(backend_port);
+
+    Result result;
+    {
+        Reactor reactor;
+        RelayType relay(reactor, client, upstream);
+
+        double cpu = thread_cpu_seconds();
+        auto start = std::chrono::steady_clock::now();
+        reactor.run();
+        result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        result.cpu_seconds = thread_cpu_seconds() - cpu;
+    }
+
+    source.join();
+    sink.join();
+    ::close(front);
+    ::close(backend);
+
+    if(received != total)
+        Logger::error() << "short transfer: " << received << " of " << total;
+    return result;
+}
+
+void report(const char * name, size_t total, const Result & r)
+{
+    double mb = total / (1024.0 * 1024.0);
+    std::printf("%-8s %10.1f MB/s %8.3f cpu-s %8.3f cpu-s/GB\n",
+                name, mb / r.seconds, r.cpu_seconds, r.cpu_seconds * 1024.0 / mb);
+}
+
+int main(int argc, char *argv[])
+{
+    size_t megabytes = argc > 1 ? std::atoi(argv[1]) : 512;
+    size_t total = megabytes << 20;
+
+    try
+    {
+        report("splice", total, run<SpliceRelay>(total));
+        report("copy", total, run<CopyRelay>(total));
+    }
+    catch(const SystemException & err)
+    {
+        Logger::error() << err.ec() << "," << err.what();
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,157 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "reactor.h"
+#include "tcp/socket.h"
+#include "buffer.h"
+
+// Checks tcp::Socket::send_file() against a peer that has hung up, from a
+// regular file and from a pipe. sendfile and splice raise SIGPIPE there,
+// which must not reach the process; the transfer fails with EPIPE instead.
+// A failed send_file() must leave its descriptor with the caller, also
+// when close_fd was set and when the error comes from data queued before.
+// Exits with 1 when a case fails; the signal would end it with 141.
+//
+//   send_file_check
+
+namespace
+{
+
+class FileSocket : public tcp::Socket
+{
+public:
+    FileSocket(Reactor & reactor, int socket)
+        : Socket(reactor, socket)
+    {
+    }
+
+protected:
+    void handle_events(Event event)
+    {
+    }
+};
+
+int failures = 0;
+
+bool is_open(int fd)
+{
+    return ::fcntl(fd, F_GETFD) != -1;
+}
+
+void expect(bool ok, const char * what)
+{
+    std::printf("%-48s %s\n", what, ok ? "ok" : "FAILED");
+    if(!ok)
+        ++failures;
+}
+
+// A socket whose peer is closed.
+int hung_up_socket()
+{
+    int sv[2];
+    if(::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) == -1)
+    {
+        std::perror("socketpair");
+        std::exit(2);
+    }
+    ::close(sv[1]);
+    return sv[0];
+}
+
+int temp_file(size_t size)
+{
+    char path[] = "/tmp/send_file_check.XXXXXX";
+    int fd = ::mkstemp(path);
+    if(fd == -1)
+    {
+        std::perror("mkstemp");
+        std::exit(2);
+    }
+    ::unlink(path);
+    std::string data(size, 'x');
+    if(::write(fd, data.data(), data.size()) != ssize_t(data.size()))
+    {
+        std::perror("write");
+        std::exit(2);
+    }
+    return fd;
+}
+
+void check_file(Reactor & reactor)
+{
+    int fd = temp_file(1 << 16);
+    {
+        FileSocket socket(reactor, hung_up_socket());
+        int ec = socket.send_file(fd, 0, 0, true);
+        expect(ec == EPIPE, "file to a hung up peer fails with EPIPE");
+        expect(socket.send_queue_size() == 0, "failed file is not queued");
+    }
+    expect(is_open(fd), "failed file stays with the caller");
+    ::close(fd);
+}
+
+// The peer hangs up while data waits in the send queue, so the file entry
+// queued behind it fails with that data.
+void check_behind_queued(Reactor & reactor)
+{
+    int sv[2];
+    if(::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) == -1)
+        std::exit(2);
+    int fd = temp_file(1 << 16);
+    {
+        FileSocket socket(reactor, sv[0]);
+        while(socket.send_queue_bytes() == 0)
+        {
+            Buffer * b = Buffer::alloc();
+            b->size = Buffer::max_size;
+            if(socket.send(b))
+                std::exit(2);
+        }
+        ::close(sv[1]);
+        int ec = socket.send_file(fd, 0, 0, true);
+        expect(ec != 0, "file behind failed data fails");
+        expect(socket.send_queue_size() > 0, "data queued before stays queued");
+    }
+    expect(is_open(fd), "file behind failed data stays with the caller");
+    ::close(fd);
+}
+
+void check_stream(Reactor & reactor)
+{
+    int p[2];
+    if(::pipe2(p, O_NONBLOCK | O_CLOEXEC) == -1)
+    {
+        std::perror("pipe2");
+        std::exit(2);
+    }
+    char data[4096];
+    std::memset(data, 'x', sizeof(data));
+    if(::write(p[1], data, sizeof(data)) != sizeof(data))
+        std::exit(2);
+
+    {
+        FileSocket socket(reactor, hung_up_socket());
+        int ec = socket.send_file(p[0], 0, sizeof(data), true);
+        expect(ec == EPIPE, "pipe to a hung up peer fails with EPIPE");
+    }
+    expect(is_open(p[0]), "failed pipe stays with the caller");
+    ::close(p[0]);
+    ::close(p[1]);
+}
+
+}
+
+int main()
+{
+    Reactor reactor;
+    check_file(reactor);
+    check_stream(reactor);
+    check_behind_queued(reactor);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,166 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unordered_set>
+#include <sys/epoll.h>
+#include <getopt.h>
+#include <time.h>
+
+#include "reactor.h"
+#include "tcp/socket.h"
+#include "trace.h"
+#include "tracereplay.h"
+#include "metrics.h"
+#include "systemexception.h"
+#include "tscclock.h"
+#include "queue.h"
+#include "buffer.h"
+
+// Replays a trace recorded by echo_server_tcp (ECHO_TRACE=<path>) through
+// the echo handler and reports how long the handler took per event, so a
+// change to it can be compared on the recorded traffic.
+//
+//   trace_replay [-s speed] [-d] trace
+//
+// speed 1 keeps the recorded timing, 0 (the default) replays as fast as
+// the handler keeps up. -d prints the records instead.
+
+using namespace detail;
+
+namespace
+{
+
+Histogram handler_ns("trace_replay_handler_ns", "Nanoseconds per echo handle_events() call.");
+
+class EchoSocket;
+
+std::unordered_set<EchoSocket *> sockets;
+
+// Echoes like the handler of echo_server_tcp.
+class EchoSocket : public tcp::Socket
+{
+public:
+    EchoSocket(Reactor & reactor, int socket)
+        : Socket(reactor, socket, true)
+    {
+        sockets.insert(this);
+    }
+
+    ~EchoSocket()
+    {
+        sockets.erase(this);
+    }
+
+protected:
+    void handle_events(Event event)
+    {
+        uint64_t start = TscClock::now();
+        bool closed = echo(event);
+        handler_ns.record((TscClock::now() - start) * 1000 / TscClock::ticks_per_us());
+        if(closed)
+            delete this;
+    }
+
+private:
+    bool echo(Event event)
+    {
+        if(event & EPOLLIN)
+        {
+            size_t bytes;
+            Queue<Buffer> bufs;
+            if(receive(bufs, bytes, event) || send(bufs))
+                return true;
+        }
+
+        if(event & EPOLLOUT)
+        {
+            if(flush())
+                return true;
+        }
+
+        return event & (EPOLLERR | EPOLLHUP);
+    }
+};
+
+uint64_t now_ns()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+int dump(const std::string & path)
+{
+    TraceReader reader(path);
+    TraceRecord r;
+    while(reader.next(r))
+        std::printf("%12.6f %c fd %d %llu\n", r.time / 1e9, char(r.op), r.fd, (unsigned long long)r.value);
+    return 0;
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    double speed = 0;
+    bool print = false;
+    int opt;
+    while((opt = ::getopt(argc, argv, "s:d")) != -1)
+    {
+        switch(opt)
+        {
+        case 's': speed = std::atof(optarg); break;
+        case 'd': print = true; break;
+        default:
+            std::fprintf(stderr, "usage: %s [-s speed] [-d] trace\n", argv[0]);
+            return 1;
+        }
+    }
+    if(optind + 1 != argc)
+    {
+        std::fprintf(stderr, "usage: %s [-s speed] [-d] trace\n", argv[0]);
+        return 1;
+    }
+
+    try
+    {
+        if(print)
+            return dump(argv[optind]);
+
+        TscClock::ticks_per_us();
+        Reactor reactor;
+        uint64_t start = now_ns();
+        TraceReplay replay(reactor, argv[optind], [](Reactor & r, int socket)
+        {
+            new EchoSocket(r, socket);
+        }, speed);
+        reactor.run();
+        double seconds = (now_ns() - start) / 1e9;
+
+        // Handlers the trace left open.
+        while(!sockets.empty())
+            delete *sockets.begin();
+
+        const TraceReplay::Stats & s = replay.stats();
+        std::printf("%llu records, %llu events, %llu connections in %.3fs (trace %.3fs, speed %g)\n",
+                    (unsigned long long)s.records, (unsigned long long)s.events,
+                    (unsigned long long)s.connections, seconds, s.trace_ns / 1e9, speed);
+        std::printf("bytes written %llu, echoed %llu, sent in recording %llu\n",
+                    (unsigned long long)s.bytes_written, (unsigned long long)s.bytes_read,
+                    (unsigned long long)s.bytes_recorded_sent);
+        std::printf("max lag %.1fus\n", s.max_lag_ns / 1e3);
+        std::printf("handler %llu calls, %.1fus total, p50 %lluns p99 %lluns p999 %lluns\n",
+                    (unsigned long long)handler_ns.count(), handler_ns.sum() / 1e3,
+                    (unsigned long long)handler_ns.percentile(0.5),
+                    (unsigned long long)handler_ns.percentile(0.99),
+                    (unsigned long long)handler_ns.percentile(0.999));
+    }
+    catch(const SystemException & err)
+    {
+        std::fprintf(stderr, "%s: %s\n", err.what(), std::strerror(err.ec()));
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,724 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <getopt.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "reactor.h"
+#include "deadlinetimer.h"
+#include "udp/socket.h"
+#include "udp/endpoint.h"
+#include "metrics.h"
+#include "systemexception.h"
+
+// UDP echo benchmark. A sender keeps up to window datagrams in flight to a
+// reactor-based echo and counts what comes back: round trips per second,
+// datagrams lost (by sequence number), reordered, and round trip time
+// percentiles, for each datagram size and I/O mode:
+//
+//   recvfrom  one recvfrom/sendto per datagram on both sides
+//   mmsg      up to 64 datagrams per recvmmsg/sendmmsg
+//   offload   UDP_SEGMENT (GSO) sends and UDP_GRO receives, so one syscall
+//             moves up to 64 datagrams of one size as a single buffer
+//
+// By default the echo runs in process on loopback, one socket per mode.
+// With -E only the echo runs, on -p, in the first mode of -m; point a sender
+// at it with -h and -p.
+//
+//   udp_bench [-h host] [-p port] [-m modes] [-s sizes] [-w window]
+//             [-D seconds] [-E] [-j]
+//
+// modes and sizes are comma separated, e.g. -m recvfrom,mmsg -s 64,1472.
+// -j prints one JSON object per mode and size.
+
+namespace
+{
+
+enum Mode
+{
+    per_packet,
+    batched,
+    offload
+};
+
+const char * mode_names[] = { "recvfrom", "mmsg", "offload" };
+
+enum
+{
+    header_size = 16,
+    max_datagram = 65507,
+    // Receive buffer per datagram; a GRO buffer of segments can exceed
+    // max_datagram.
+    slot = 1 << 16,
+    batch = 64,
+    socket_buffer = 4 << 20,
+    drain_ms = 200
+};
+
+std::string host;
+int port = 0;
+std::vector<Mode> modes;
+std::vector<size_t> sizes;
+int window = 256;
+int duration = 2;
+bool echo_only = false;
+bool json = false;
+
+uint64_t now_ns()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+void set_buffers(int fd)
+{
+    int size = socket_buffer;
+    ::setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    ::setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+}
+
+// Most datagrams of size one GSO send may carry.
+int segments(size_t size)
+{
+    return std::max<int>(1, std::min<int>(batch, 65000 / size));
+}
+
+void set_segment(msghdr & msg, char * control, uint16_t size)
+{
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+    cmsghdr * cm = CMSG_FIRSTHDR(&msg);
+    cm->cmsg_level = SOL_UDP;
+    cm->cmsg_type = UDP_SEGMENT;
+    cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+    std::memcpy(CMSG_DATA(cm), &size, sizeof(size));
+}
+
+// Receive buffers and headers for one recvmmsg/sendmmsg batch.
+struct Batch
+{
+    Batch()
+        : data(size_t(batch) * slot)
+        , iov(batch)
+        , msgs(batch)
+        , addrs(batch)
+    {
+        reset();
+    }
+
+    void reset()
+    {
+        for(int i = 0; i < batch; ++i)
+        {
+            iov[i].iov_base = &data[size_t(i) * slot];
+            iov[i].iov_len = slot;
+            std::memset(&msgs[i], 0, sizeof(msgs[i]));
+            msgs[i].msg_hdr.msg_iov = &iov[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            msgs[i].msg_hdr.msg_name = &addrs[i];
+            msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+        }
+    }
+
+    char * buffer(int i) { return static_cast<char *>(iov[i].iov_base); }
+
+    std::vector<char> data;
+    std::vector<iovec> iov;
+    std::vector<mmsghdr> msgs;
+    std::vector<sockaddr_storage> addrs;
+};
+
+// Echoes every datagram back to its sender. Replies that do not fit in the
+// send buffer are dropped, as a real UDP server would.
+class EchoSocket : public udp::Socket
+{
+public:
+    EchoSocket(Reactor & reactor, const udp::Endpoint & ep, Mode mode)
+        : Socket(reactor, ep)
+        , mode_(mode)
+        , datagrams_(0)
+        , syscalls_(0)
+        , dropped_(0)
+    {
+        set_buffers(handle());
+        int on = 1;
+        if(mode_ == offload && ::setsockopt(handle(), SOL_UDP, UDP_GRO, &on, sizeof(on)) == -1)
+            throw_error(errno, "enable UDP_GRO");
+    }
+
+    uint64_t datagrams() const { return datagrams_.load(std::memory_order_relaxed); }
+    uint64_t syscalls() const { return syscalls_.load(std::memory_order_relaxed); }
+    uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+protected:
+    void handle_events(Event event)
+    {
+        if(!(event & EPOLLIN))
+            return;
+
+        switch(mode_)
+        {
+        case per_packet: echo_per_packet(); break;
+        case batched: echo_batched(); break;
+        case offload: echo_offload(); break;
+        }
+    }
+
+private:
+    void echo_per_packet()
+    {
+        char * data = batch_.buffer(0);
+        for(;;)
+        {
+            sockaddr_storage addr;
+            socklen_t len = sizeof(addr);
+            ssize_t n = ::recvfrom(handle(), data, slot, 0, (sockaddr *)&addr, &len);
+            if(n < 0)
+                break;
+            if(::sendto(handle(), data, n, 0, (sockaddr *)&addr, len) < 0)
+                add(dropped_, 1);
+            add(datagrams_, 1);
+            add(syscalls_, 2);
+        }
+        add(syscalls_, 1);
+    }
+
+    void echo_batched()
+    {
+        for(;;)
+        {
+            batch_.reset();
+            int n = ::recvmmsg(handle(), &batch_.msgs[0], batch, 0, 0);
+            add(syscalls_, 1);
+            if(n <= 0)
+                break;
+            for(int i = 0; i < n; ++i)
+                batch_.iov[i].iov_len = batch_.msgs[i].msg_len;
+            int sent = ::sendmmsg(handle(), &batch_.msgs[0], n, 0);
+            add(syscalls_, 1);
+            add(dropped_, n - std::max(sent, 0));
+            add(datagrams_, n);
+        }
+    }
+
+    void echo_offload()
+    {
+        char * data = batch_.buffer(0);
+        for(;;)
+        {
+            sockaddr_storage addr;
+            iovec iov = { data, slot };
+            char control[CMSG_SPACE(sizeof(int))];
+            msghdr msg;
+            std::memset(&msg, 0, sizeof(msg));
+            msg.msg_name = &addr;
+            msg.msg_namelen = sizeof(addr);
+            msg.msg_iov = &iov;
+            msg.msg_iovlen = 1;
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+            ssize_t n = ::recvmsg(handle(), &msg, 0);
+            add(syscalls_, 1);
+            if(n < 0)
+                break;
+
+            // Without the control message the datagram was not coalesced.
+            size_t segment = n;
+            for(cmsghdr * cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm))
+            {
+                if(cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO)
+                {
+                    int size;
+                    std::memcpy(&size, CMSG_DATA(cm), sizeof(size));
+                    segment = size;
+                }
+            }
+            size_t count = (n + segment - 1) / segment;
+
+            iov.iov_len = n;
+            char reply_control[CMSG_SPACE(sizeof(uint16_t))];
+            msg.msg_control = 0;
+            msg.msg_controllen = 0;
+            if(count > 1)
+                set_segment(msg, reply_control, segment);
+            if(::sendmsg(handle(), &msg, 0) < 0)
+                add(dropped_, count);
+            add(syscalls_, 1);
+            add(datagrams_, count);
+        }
+    }
+
+    // Written by the reactor thread only, read by the sender.
+    static void add(std::atomic<uint64_t> & value, uint64_t n)
+    {
+        value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    Mode mode_;
+    Batch batch_;
+    std::atomic<uint64_t> datagrams_;
+    std::atomic<uint64_t> syscalls_;
+    std::atomic<uint64_t> dropped_;
+};
+
+class StopTimer : public DeadlineTimer
+{
+public:
+    StopTimer(Reactor & reactor, std::atomic<bool> & done)
+        : DeadlineTimer(reactor)
+        , reactor_(reactor)
+        , done_(done)
+    {
+        set_interval(1);
+    }
+
+protected:
+    void handle_events(Event event)
+    {
+        uint64_t exp;
+        while(::read(handle(), &exp, sizeof(exp)) == sizeof(exp))
+            ;
+        if(done_)
+            reactor_.stop();
+    }
+
+private:
+    Reactor & reactor_;
+    std::atomic<bool> & done_;
+};
+
+struct Result
+{
+    Result()
+        : sent(0)
+        , received(0)
+        , reordered(0)
+        , duplicates(0)
+        , syscalls(0)
+        , seconds(0)
+        , rtt(Histogram::buckets, 0)
+        , max_ns(0)
+    {
+    }
+
+    // Upper bound of the bucket holding the q-th quantile, as Histogram,
+    // but no more than the largest sample.
+    double percentile_us(double q) const
+    {
+        uint64_t rank = uint64_t(q * received);
+        uint64_t seen = 0;
+        for(size_t i = 0; i < rtt.size(); ++i)
+        {
+            seen += rtt[i];
+            if(seen > rank)
+            {
+                uint64_t bound = i + 1 < rtt.size() ? Histogram::lower_bound(i + 1) - 1 : max_ns;
+                return std::min(bound, max_ns) / 1e3;
+            }
+        }
+        return 0;
+    }
+
+    uint64_t sent;
+    uint64_t received;
+    uint64_t reordered;
+    uint64_t duplicates;
+    uint64_t syscalls;
+    double seconds;
+    std::vector<uint64_t> rtt;
+    uint64_t max_ns;
+};
+
+// Blocking sender over a connected socket: sends while fewer than window
+// datagrams are outstanding and gives up on the outstanding ones after 10ms
+// without a reply, so a lossy path does not stall it.
+class Sender
+{
+public:
+    Sender(const udp::Endpoint & ep, Mode mode, size_t size)
+        : mode_(mode)
+        , size_(size)
+        , fd_(::socket(ep.family(), SOCK_DGRAM | SOCK_CLOEXEC, 0))
+        , next_seq_(0)
+        , highest_(0)
+        , written_off_(0)
+        , out_(size_t(segments(size)) * size, 'x')
+    {
+        if(fd_ == -1)
+            throw_error(errno, "create udp socket");
+        set_buffers(fd_);
+        if(::connect(fd_, ep.data(), ep.size()) == -1)
+            throw_error(errno, "connect udp socket");
+    }
+
+    ~Sender()
+    {
+        ::close(fd_);
+    }
+
+    Result run(int seconds)
+    {
+        uint64_t start = now_ns();
+        uint64_t end = start + uint64_t(seconds) * 1000000000;
+        while(now_ns() < end)
+        {
+            int64_t credit = window - in_flight();
+            if(credit > 0)
+                send(std::min<int64_t>(credit, batch));
+            if(receive() == 0 && in_flight() >= window && !wait(10))
+                written_off_ = result_.sent - result_.received;
+        }
+        result_.seconds = (now_ns() - start) / 1e9;
+
+        // Late replies still count, but not towards the rate.
+        while(in_flight() > 0 && wait(drain_ms))
+            receive();
+        return result_;
+    }
+
+private:
+    int64_t in_flight() const
+    {
+        return int64_t(result_.sent) - int64_t(result_.received) - int64_t(written_off_);
+    }
+
+    bool wait(int ms)
+    {
+        pollfd p = { fd_, POLLIN, 0 };
+        return ::poll(&p, 1, ms) > 0;
+    }
+
+    void stamp(char * data)
+    {
+        uint64_t header[2] = { next_seq_++, now_ns() };
+        std::memcpy(data, header, sizeof(header));
+    }
+
+    void send(int count)
+    {
+        int sent = 0;
+        switch(mode_)
+        {
+        case per_packet:
+            for(; sent < count; ++sent)
+            {
+                stamp(&out_[0]);
+                ++result_.syscalls;
+                if(::send(fd_, &out_[0], size_, 0) < 0)
+                {
+                    --next_seq_;
+                    break;
+                }
+            }
+            break;
+
+        case batched:
+        {
+            mmsghdr msgs[batch];
+            iovec parts[batch][2];
+            std::memset(msgs, 0, sizeof(msgs));
+            for(int i = 0; i < count; ++i)
+            {
+                // Only the header differs, so the payload is shared.
+                stamp(headers_[i]);
+                parts[i][0].iov_base = headers_[i];
+                parts[i][0].iov_len = header_size;
+                parts[i][1].iov_base = &out_[header_size];
+                parts[i][1].iov_len = size_ - header_size;
+                msgs[i].msg_hdr.msg_iov = parts[i];
+                msgs[i].msg_hdr.msg_iovlen = 2;
+            }
+            ++result_.syscalls;
+            sent = std::max(::sendmmsg(fd_, msgs, count, 0), 0);
+            next_seq_ -= count - sent;
+            break;
+        }
+
+        case offload:
+        {
+            count = std::min(count, segments(size_));
+            for(int i = 0; i < count; ++i)
+                stamp(&out_[i * size_]);
+            iovec iov = { &out_[0], count * size_ };
+            msghdr msg;
+            std::memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = &iov;
+            msg.msg_iovlen = 1;
+            char control[CMSG_SPACE(sizeof(uint16_t))];
+            if(count > 1)
+                set_segment(msg, control, size_);
+            ++result_.syscalls;
+            if(::sendmsg(fd_, &msg, 0) < 0)
+            {
+                if(errno != EAGAIN && errno != ENOBUFS)
+                    throw_error(errno, "send with UDP_SEGMENT");
+                next_seq_ -= count;
+            }
+            else
+                sent = count;
+            break;
+        }
+        }
+        result_.sent += sent;
+        if(!sent)
+            wait(1);
+    }
+
+    // Takes every reply that is waiting; returns how many.
+    int receive()
+    {
+        int total = 0;
+        for(;;)
+        {
+            int n;
+            if(mode_ == per_packet)
+            {
+                ++result_.syscalls;
+                ssize_t bytes = ::recv(fd_, batch_.buffer(0), slot, MSG_DONTWAIT);
+                n = bytes < 0 ? 0 : 1;
+                batch_.msgs[0].msg_len = bytes;
+            }
+            else
+            {
+                batch_.reset();
+                ++result_.syscalls;
+                n = std::max(::recvmmsg(fd_, &batch_.msgs[0], batch, MSG_DONTWAIT, 0), 0);
+            }
+            if(n == 0)
+                return total;
+
+            uint64_t now = now_ns();
+            for(int i = 0; i < n; ++i)
+            {
+                if(batch_.msgs[i].msg_len >= header_size)
+                    complete(batch_.buffer(i), now);
+            }
+            total += n;
+        }
+    }
+
+    void complete(const char * data, uint64_t now)
+    {
+        uint64_t header[2];
+        std::memcpy(header, data, sizeof(header));
+        uint64_t seq = header[0];
+        if(seq >= next_seq_)
+            return;
+        if(seen_.size() <= seq)
+            seen_.resize(std::max<uint64_t>(seq + 1, seen_.size() * 2));
+        if(seen_[seq])
+        {
+            ++result_.duplicates;
+            return;
+        }
+        seen_[seq] = true;
+        if(seq < highest_)
+            ++result_.reordered;
+        highest_ = std::max(highest_, seq);
+
+        // A reply to a datagram already written off gives the credit back.
+        if(in_flight() <= 0 && written_off_)
+            --written_off_;
+        ++result_.received;
+        uint64_t ns = now - header[1];
+        ++result_.rtt[Histogram::bucket(ns)];
+        result_.max_ns = std::max(result_.max_ns, ns);
+    }
+
+    Mode mode_;
+    size_t size_;
+    int fd_;
+    uint64_t next_seq_;
+    uint64_t highest_;
+    uint64_t written_off_;
+    std::vector<char> out_;
+    char headers_[batch][header_size];
+    std::vector<bool> seen_;
+    Batch batch_;
+    Result result_;
+};
+
+// server is the echo's syscalls per datagram, 0 when it runs elsewhere.
+void report(Mode mode, size_t size, const Result & r, double server)
+{
+    double rate = r.received / r.seconds;
+    double lost = r.sent ? 100.0 * (r.sent - r.received) / r.sent : 0;
+    double client = r.sent ? double(r.syscalls) / r.sent : 0;
+    if(json)
+    {
+        std::printf("{\"mode\":\"%s\",\"size\":%zu,\"window\":%d,\"duration_s\":%.2f,"
+                    "\"sent\":%llu,\"received\":%llu,\"lost_pct\":%.3f,\"reordered\":%llu,"
+                    "\"duplicates\":%llu,\"pps\":%.0f,\"mb_per_s\":%.2f,"
+                    "\"p50_us\":%.1f,\"p99_us\":%.1f,\"p999_us\":%.1f,\"max_us\":%.1f,"
+                    "\"client_syscalls_per_pkt\":%.3f,\"server_syscalls_per_pkt\":%.3f}\n",
+                    mode_names[mode], size, window, r.seconds,
+                    (unsigned long long)r.sent, (unsigned long long)r.received, lost,
+                    (unsigned long long)r.reordered, (unsigned long long)r.duplicates,
+                    rate, rate * size / 1e6, r.percentile_us(0.5), r.percentile_us(0.99),
+                    r.percentile_us(0.999), r.max_ns / 1e3, client, server);
+    }
+    else
+    {
+        std::printf("%-8s %6zu %10.0f %9.1f %8.3f%% %8llu %8.1f %8.1f %8.1f %9.1f %6.2f %6.2f\n",
+                    mode_names[mode], size, rate, rate * size / 1e6, lost,
+                    (unsigned long long)r.reordered, r.percentile_us(0.5),
+                    r.percentile_us(0.99), r.percentile_us(0.999), r.max_ns / 1e3,
+                    client, server);
+    }
+    std::fflush(stdout);
+}
+
+template <typename T, typename Parse>
+bool parse_list(const char * arg, std::vector<T> & out, Parse parse)
+{
+    out.clear();
+    std::string s(arg);
+    for(size_t pos = 0; pos <= s.size();)
+    {
+        size_t comma = std::min(s.find(',', pos), s.size());
+        T value;
+        if(!parse(s.substr(pos, comma - pos), value))
+            return false;
+        out.push_back(value);
+        pos = comma + 1;
+    }
+    return !out.empty();
+}
+
+bool parse_mode(const std::string & s, Mode & mode)
+{
+    for(int i = 0; i < 3; ++i)
+    {
+        if(s == mode_names[i])
+        {
+            mode = Mode(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool parse_size(const std::string & s, size_t & size)
+{
+    size = std::strtoul(s.c_str(), 0, 10);
+    size = std::min<size_t>(size, max_datagram);
+    return size >= header_size;
+}
+
+void usage(const char * name)
+{
+    std::fprintf(stderr,
+                 "usage: %s [-h host] [-p port] [-m recvfrom,mmsg,offload] [-s sizes]\n"
+                 "          [-w window] [-D seconds] [-E] [-j]\n",
+                 name);
+    std::exit(1);
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    modes = { per_packet, batched, offload };
+    sizes = { 64, 512, 1472, 8192, 32768, max_datagram };
+
+    int opt;
+    while((opt = ::getopt(argc, argv, "h:p:m:s:w:D:Ej")) != -1)
+    {
+        switch(opt)
+        {
+        case 'h': host = optarg; break;
+        case 'p': port = std::atoi(optarg); break;
+        case 'm': if(!parse_list(optarg, modes, parse_mode)) usage(argv[0]); break;
+        case 's': if(!parse_list(optarg, sizes, parse_size)) usage(argv[0]); break;
+        case 'w': window = std::atoi(optarg); break;
+        case 'D': duration = std::atoi(optarg); break;
+        case 'E': echo_only = true; break;
+        case 'j': json = true; break;
+        default: usage(argv[0]);
+        }
+    }
+    if(window < 1 || duration < 1 || (echo_only && !host.empty()))
+        usage(argv[0]);
+
+    try
+    {
+        if(echo_only)
+        {
+            Reactor reactor;
+            EchoSocket echo(reactor, udp::Endpoint("0.0.0.0", port), modes[0]);
+            reactor.run();
+            return 0;
+        }
+
+        // One in process echo socket per mode unless a host was given.
+        std::atomic<bool> done(false);
+        Reactor reactor;
+        StopTimer timer(reactor, done);
+        std::vector<std::unique_ptr<EchoSocket> > echoes;
+        std::vector<udp::Endpoint> targets;
+        for(Mode mode : modes)
+        {
+            if(!host.empty())
+            {
+                targets.push_back(udp::Endpoint(host, port));
+                echoes.emplace_back();
+                continue;
+            }
+            udp::Endpoint ep("127.0.0.1", 0);
+            echoes.emplace_back(new EchoSocket(reactor, ep, mode));
+            socklen_t size = ep.capacity();
+            ::getsockname(echoes.back()->handle(), ep.data(), &size);
+            ep.resize(size);
+            targets.push_back(ep);
+        }
+        std::thread server([&]
+        {
+            Metrics::set_thread_name("echo");
+            reactor.run();
+        });
+
+        if(!json)
+            std::printf("%-8s %6s %10s %9s %9s %8s %8s %8s %8s %9s %6s %6s\n",
+                        "mode", "size", "pkt/s", "MB/s", "lost", "reorder", "p50us",
+                        "p99us", "p999us", "maxus", "c-sys", "s-sys");
+        for(size_t i = 0; i < modes.size(); ++i)
+        {
+            for(size_t size : sizes)
+            {
+                // Only this run's share of the echo's work.
+                EchoSocket * echo = echoes[i].get();
+                uint64_t datagrams = echo ? echo->datagrams() : 0;
+                uint64_t syscalls = echo ? echo->syscalls() : 0;
+                Result r = Sender(targets[i], modes[i], size).run(duration);
+                double server = 0;
+                if(echo && echo->datagrams() > datagrams)
+                    server = double(echo->syscalls() - syscalls) / (echo->datagrams() - datagrams);
+                report(modes[i], size, r, server);
+            }
+        }
+
+        done = true;
+        server.join();
+    }
+    catch(const SystemException & err)
+    {
+        std::fprintf(stderr, "%s: %s\n", err.what(), std::strerror(err.ec()));
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,148 @@
+#include "trace.h"
+
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "logger.h"
+#include "systemexception.h"
+#include "tscclock.h"
+
+namespace
+{
+
+const char magic[8] = { 'R', 'T', 'R', 'A', 'C', 'E', '0', '1' };
+
+bool write_all(int fd, const char * data, size_t size)
+{
+    while(size)
+    {
+        ssize_t n = ::write(fd, data, size);
+        if(n < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            return false;
+        }
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+}
+
+thread_local TraceRecorder * TraceRecorder::active_ = 0;
+
+TraceRecorder::TraceRecorder(const std::string & path)
+    : fd_(::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644))
+    , size_(sizeof(magic))
+    , last_(0)
+    , records_(0)
+    , flushed_(detail::TscClock::now())
+    , flush_ticks_(detail::TscClock::from_us(1000000))
+{
+    if(fd_ == -1)
+        throw_error(errno, "open trace");
+    std::memcpy(buffer_, magic, sizeof(magic));
+}
+
+TraceRecorder::~TraceRecorder()
+{
+    flush();
+    ::close(fd_);
+}
+
+void TraceRecorder::record(Op op, int fd, uint64_t value)
+{
+    if(size_ + max_record > buffer_size)
+        flush();
+
+    uint64_t now = detail::TscClock::now();
+    uint64_t delta = records_ ? now - last_ : 0;
+    last_ = now;
+    ++records_;
+
+    buffer_[size_++] = char(op);
+    put(uint64_t(delta * 1000 / detail::TscClock::ticks_per_us()));
+    put(uint64_t(fd));
+    put(value);
+
+    // So a process that is killed loses about a second of records.
+    if(now - flushed_ > flush_ticks_)
+        flush();
+}
+
+void TraceRecorder::flush()
+{
+    // A failed write loses the buffered records rather than stalling the
+    // loop; the trace then ends early.
+    if(size_ && !write_all(fd_, buffer_, size_))
+    {
+        LOG_ERROR << "trace write failed: " << strerror(errno);
+    }
+    size_ = 0;
+    flushed_ = detail::TscClock::now();
+}
+
+void TraceRecorder::put(uint64_t value)
+{
+    while(value >= 0x80)
+    {
+        buffer_[size_++] = char(value | 0x80);
+        value >>= 7;
+    }
+    buffer_[size_++] = char(value);
+}
+
+TraceReader::TraceReader(const std::string & path)
+    : file_(std::fopen(path.c_str(), "rbe"))
+    , time_(0)
+{
+    if(!file_)
+        throw_error(errno, "open trace");
+
+    char header[sizeof(magic)];
+    if(std::fread(header, 1, sizeof(header), file_) != sizeof(header)
+       || std::memcmp(header, magic, sizeof(magic)) != 0)
+    {
+        std::fclose(file_);
+        throw_error(EINVAL, "not a reactor trace");
+    }
+}
+
+TraceReader::~TraceReader()
+{
+    std::fclose(file_);
+}
+
+bool TraceReader::next(TraceRecord & record)
+{
+    int op = getc_unlocked(file_);
+    uint64_t delta, fd, value;
+    if(op == EOF || !get(delta) || !get(fd) || !get(value))
+        return false;
+
+    time_ += delta;
+    record.op = TraceRecorder::Op(op);
+    record.fd = int(fd);
+    record.value = value;
+    record.time = time_;
+    return true;
+}
+
+bool TraceReader::get(uint64_t & value)
+{
+    value = 0;
+    for(int shift = 0; shift < 64; shift += 7)
+    {
+        int c = getc_unlocked(file_);
+        if(c == EOF)
+            return false;
+        value |= uint64_t(c & 0x7f) << shift;
+        if(!(c & 0x80))
+            return true;
+    }
+    return false;
+}
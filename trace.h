@@ -0,0 +1,104 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <cstdio>
+#include <stdint.h>
+#include <string>
+
+#include "noncopyable.h"
+
+// Compact binary trace of what a reactor saw: registrations, readiness
+// events, bytes received and sent and descriptors closed, each stamped with
+// the time since the previous record. Reactor::set_recorder() turns it on;
+// socket_ops reports the bytes and closes of the loop thread through
+// TraceRecorder::note(). TraceReplay feeds a trace back to handlers.
+//
+// A trace starts with the magic "RTRACE01", followed by records of
+//   uint8  op     one of TraceRecorder::Op
+//   varint delta  nanoseconds since the previous record
+//   varint fd
+//   varint value  epoll events for open and event, bytes for recv and send
+// with varints in LEB128, 7 bits per byte, low bits first.
+class TraceRecorder : private Noncopyable
+{
+public:
+    enum Op
+    {
+        open = 'O',
+        event = 'E',
+        recv = 'R',
+        send = 'S',
+        close = 'C'
+    };
+
+    // Creates or truncates path. Throws SystemException.
+    explicit TraceRecorder(const std::string & path);
+
+    // Flushes and closes the file.
+    ~TraceRecorder();
+
+    void record(Op op, int fd, uint64_t value);
+
+    // Write out buffered records. Done when the buffer is full and, while
+    // records come in, once a second.
+    void flush();
+
+    // Records written so far.
+    uint64_t records() const { return records_; }
+
+    // The recorder of the reactor running on this thread, null when that
+    // is not recording. Set by Reactor::run().
+    static TraceRecorder * active() { return active_; }
+    static void activate(TraceRecorder * recorder) { active_ = recorder; }
+
+    // Record op if this thread is recording; a thread local load otherwise.
+    static void note(Op op, int fd, uint64_t value)
+    {
+        if(active_)
+            active_->record(op, fd, value);
+    }
+
+private:
+    enum { buffer_size = 64 * 1024, max_record = 1 + 3 * 10 };
+
+    void put(uint64_t value);
+
+    int fd_;
+    char buffer_[buffer_size];
+    size_t size_;
+    uint64_t last_;
+    uint64_t records_;
+    uint64_t flushed_;
+    uint64_t flush_ticks_;
+
+    static thread_local TraceRecorder * active_;
+};
+
+struct TraceRecord
+{
+    TraceRecorder::Op op;
+    int fd;
+    uint64_t value;
+
+    // Nanoseconds since the first record.
+    uint64_t time;
+};
+
+class TraceReader : private Noncopyable
+{
+public:
+    // Throws SystemException when path cannot be opened or is no trace.
+    explicit TraceReader(const std::string & path);
+    ~TraceReader();
+
+    // Next record; false at the end of the trace or at a truncated record.
+    bool next(TraceRecord & record);
+
+private:
+    bool get(uint64_t & value);
+
+    std::FILE * file_;
+    uint64_t time_;
+};
+
+#endif // TRACE_H
@@ -0,0 +1,272 @@
+#include "tracereplay.h"
+
+#include <algorithm>
+#include <cstring>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+
+#include "clock.h"
+#include "systemexception.h"
+
+namespace
+{
+
+char filler[64 * 1024];
+
+}
+
+// The replay's end of one connection. Writes what the recording received,
+// discards what the handler sends.
+class TraceReplay::Peer : public EventHandler
+{
+public:
+    Peer(TraceReplay & replay, int traced_fd, int fd)
+        : replay_(replay)
+        , traced_fd_(traced_fd)
+        , fd_(fd)
+        , backlog_(0)
+        , closing_(false)
+    {
+    }
+
+    ~Peer()
+    {
+        ::close(fd_);
+    }
+
+    virtual Handle handle() { return fd_; }
+
+    int traced_fd() const { return traced_fd_; }
+
+    void write(uint64_t bytes)
+    {
+        backlog_ += bytes;
+        pump();
+    }
+
+    // Shut down writing once the backlog is out.
+    void close()
+    {
+        closing_ = true;
+        pump();
+    }
+
+protected:
+    void handle_events(Event events)
+    {
+        if(events & EPOLLOUT)
+            pump();
+
+        if(events & EPOLLIN)
+        {
+            char buf[16 * 1024];
+            for(;;)
+            {
+                ssize_t n = ::read(fd_, buf, sizeof(buf));
+                if(n > 0)
+                {
+                    replay_.stats_.bytes_read += n;
+                    continue;
+                }
+                if(n == 0 || (errno != EAGAIN && errno != EINTR))
+                {
+                    // The handler closed its end; deletes this.
+                    replay_.remove(this);
+                    return;
+                }
+                if(errno == EAGAIN)
+                    break;
+            }
+        }
+
+        if(events & (EPOLLERR | EPOLLHUP))
+            replay_.remove(this);
+    }
+
+private:
+    void pump()
+    {
+        while(backlog_)
+        {
+            ssize_t n = ::send(fd_, filler, std::min<uint64_t>(backlog_, sizeof(filler)), MSG_NOSIGNAL);
+            if(n < 0)
+            {
+                if(errno == EINTR)
+                    continue;
+                // Full: EPOLLOUT resumes. On errors EPOLLERR follows.
+                return;
+            }
+            backlog_ -= n;
+            replay_.stats_.bytes_written += n;
+        }
+        if(closing_)
+            ::shutdown(fd_, SHUT_WR);
+    }
+
+    TraceReplay & replay_;
+    int traced_fd_;
+    int fd_;
+    uint64_t backlog_;
+    bool closing_;
+};
+
+TraceReplay::TraceReplay(Reactor & reactor, const std::string & path, const Factory & factory, double speed)
+    : reactor_(reactor)
+    , reader_(path)
+    , factory_(factory)
+    , speed_(speed)
+    , timer_fd_(::timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC))
+    , start_(MonoClock::now())
+    , done_(false)
+{
+    if(timer_fd_ == -1)
+        throw_error(errno, "timerfd");
+    std::memset(&stats_, 0, sizeof(stats_));
+    std::memset(filler, 'x', sizeof(filler));
+
+    done_ = !reader_.next(next_);
+    int ec = reactor_.register_handle(this, EPOLLIN | EPOLLET);
+    throw_error(ec, "register trace replay");
+    schedule(start_);
+}
+
+TraceReplay::~TraceReplay()
+{
+    reactor_.deregister_handle(this);
+    ::close(timer_fd_);
+    for(Peer * p : live_)
+    {
+        reactor_.deregister_handle(p);
+        delete p;
+    }
+}
+
+void TraceReplay::handle_events(Event events)
+{
+    uint64_t expirations;
+    while(::read(timer_fd_, &expirations, sizeof(expirations)) == sizeof(expirations))
+        ;
+
+    // A bounded number per tick, so handlers run between the writes even
+    // when the replay is behind.
+    uint64_t now = MonoClock::now();
+    for(int i = 0; i < records_per_tick && !done_; ++i)
+    {
+        uint64_t at = due(next_);
+        if(at > now)
+            break;
+        stats_.max_lag_ns = std::max(stats_.max_lag_ns, now - at);
+        replay(next_);
+        done_ = !reader_.next(next_);
+    }
+
+    if(!done_)
+    {
+        schedule(now);
+        return;
+    }
+
+    // Whatever the trace left open ends with it.
+    while(!peers_.empty())
+        unmap(peers_.begin()->first);
+    if(live_.empty())
+        reactor_.stop();
+}
+
+void TraceReplay::replay(const TraceRecord & record)
+{
+    ++stats_.records;
+    stats_.trace_ns = record.time;
+
+    switch(record.op)
+    {
+    case TraceRecorder::open:
+        // A registration under a descriptor still in use means the close
+        // was not seen, e.g. a handle closed without deregistering.
+        unmap(record.fd);
+        break;
+
+    case TraceRecorder::event:
+        ++stats_.events;
+        break;
+
+    case TraceRecorder::recv:
+        if(record.value)
+            connect(record.fd)->write(record.value);
+        else
+            unmap(record.fd);
+        break;
+
+    case TraceRecorder::send:
+        stats_.bytes_recorded_sent += record.value;
+        break;
+
+    case TraceRecorder::close:
+        unmap(record.fd);
+        break;
+    }
+}
+
+TraceReplay::Peer * TraceReplay::connect(int fd)
+{
+    Peer *& peer = peers_[fd];
+    if(peer)
+        return peer;
+
+    int fds[2];
+    if(::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, fds) == -1)
+        throw_error(errno, "socketpair");
+    peer = new Peer(*this, fd, fds[0]);
+    live_.insert(peer);
+    int ec = reactor_.register_handle(peer, EPOLLIN | EPOLLOUT | EPOLLET);
+    throw_error(ec, "register replay peer");
+    ++stats_.connections;
+
+    factory_(reactor_, fds[1]);
+    return peer;
+}
+
+void TraceReplay::unmap(int fd)
+{
+    auto i = peers_.find(fd);
+    if(i == peers_.end())
+        return;
+    Peer * peer = i->second;
+    peers_.erase(i);
+    peer->close();
+}
+
+void TraceReplay::remove(Peer * peer)
+{
+    auto i = peers_.find(peer->traced_fd());
+    if(i != peers_.end() && i->second == peer)
+        peers_.erase(i);
+    live_.erase(peer);
+    reactor_.deregister_handle(peer);
+    delete peer;
+
+    if(done())
+        reactor_.stop();
+}
+
+void TraceReplay::schedule(uint64_t now)
+{
+    // Overdue records go out on the next loop iteration.
+    uint64_t at = done_ ? now : std::max(due(next_), now + 1);
+    itimerspec spec;
+    std::memset(&spec, 0, sizeof(spec));
+    spec.it_value.tv_sec = at / 1000000000;
+    spec.it_value.tv_nsec = at % 1000000000;
+    ::timerfd_settime(timer_fd_, TFD_TIMER_ABSTIME, &spec, 0);
+}
+
+uint64_t TraceReplay::due(const TraceRecord & record) const
+{
+    if(speed_ <= 0)
+        return start_;
+    return start_ + uint64_t(record.time / speed_);
+}
@@ -0,0 +1,94 @@
+#ifndef TRACEREPLAY_H
+#define TRACEREPLAY_H
+
+#include <functional>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "reactor.h"
+#include "trace.h"
+#include "noncopyable.h"
+
+// Feeds a trace recorded with Reactor::set_recorder() back to live handlers,
+// so handler changes can be measured against recorded traffic. Every traced
+// descriptor that received data becomes a socketpair: factory gets one end,
+// as Acceptor::handle_accept() gets an accepted socket, and the replay
+// writes the recorded receives into the other end at their recorded times,
+// divided by speed, and reads back whatever the handler sends. A recorded
+// close or end of stream shuts down the replay's end so the handler sees
+// the peer go away. Descriptors that never received data, e.g. listeners
+// and timers, are not replayed.
+//
+// The clock starts with the constructor, so run the reactor right after.
+// Its run() returns once the trace is done and every handler closed its end.
+class TraceReplay : public EventHandler, private Noncopyable
+{
+public:
+    typedef std::function<void(Reactor & reactor, int socket)> Factory;
+
+    // speed 1 keeps the recorded timing, 10 replays ten times faster, 0 as
+    // fast as the handlers keep up. Throws SystemException.
+    TraceReplay(Reactor & reactor, const std::string & path, const Factory & factory, double speed = 1);
+    ~TraceReplay();
+
+    virtual Handle handle() { return timer_fd_; }
+
+    struct Stats
+    {
+        uint64_t records;
+        uint64_t events;
+        uint64_t connections;
+
+        // Bytes the replay wrote to handlers, read back from them, and the
+        // handlers sent in the recording.
+        uint64_t bytes_written;
+        uint64_t bytes_read;
+        uint64_t bytes_recorded_sent;
+
+        // Length of the trace, and how far behind schedule the replay fell
+        // at most; large lag means the handlers could not keep up.
+        uint64_t trace_ns;
+        uint64_t max_lag_ns;
+    };
+
+    const Stats & stats() const { return stats_; }
+
+    bool done() const { return done_ && live_.empty(); }
+
+protected:
+    void handle_events(Event events);
+
+private:
+    class Peer;
+    friend class Peer;
+
+    enum { records_per_tick = 256 };
+
+    void replay(const TraceRecord & record);
+    Peer * connect(int fd);
+    void unmap(int fd);
+    void remove(Peer * peer);
+    void schedule(uint64_t now);
+    uint64_t due(const TraceRecord & record) const;
+
+    Reactor & reactor_;
+    TraceReader reader_;
+    Factory factory_;
+    double speed_;
+    int timer_fd_;
+
+    uint64_t start_;
+    TraceRecord next_;
+    bool done_;
+
+    // Live connections by traced descriptor, and all live connections
+    // including those whose close was replayed.
+    std::unordered_map<int, Peer *> peers_;
+    std::unordered_set<Peer *> live_;
+
+    Stats stats_;
+};
+
+#endif // TRACEREPLAY_H
@@ -0,0 +1,78 @@
+#ifndef TSCCLOCK_H
+#define TSCCLOCK_H
+
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace detail
+{
+
+// Cheap timestamps for measuring short intervals: the time stamp counter
+// where there is one, CLOCK_MONOTONIC nanoseconds elsewhere. Ticks are only
+// comparable within one machine and are converted with the rate measured
+// on first use of ticks_per_us().
+class TscClock
+{
+public:
+  static uint64_t now()
+  {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return monotonic_ns();
+#endif
+  }
+
+  static double ticks_per_us()
+  {
+    static const double rate = calibrate();
+    return rate;
+  }
+
+  static uint64_t to_us(uint64_t ticks)
+  {
+    return static_cast<uint64_t>(ticks / ticks_per_us());
+  }
+
+  static uint64_t to_ns(uint64_t ticks)
+  {
+    return static_cast<uint64_t>(ticks * 1000 / ticks_per_us());
+  }
+
+  static uint64_t from_us(uint64_t us)
+  {
+    return static_cast<uint64_t>(us * ticks_per_us());
+  }
+
+private:
+  static uint64_t monotonic_ns()
+  {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+  }
+
+  // Blocks the caller for about 10ms.
+  static double calibrate()
+  {
+#if defined(__x86_64__) || defined(__i386__)
+    uint64_t ns0 = monotonic_ns();
+    uint64_t t0 = __rdtsc();
+    ::usleep(10000);
+    uint64_t ns1 = monotonic_ns();
+    uint64_t t1 = __rdtsc();
+    return double(t1 - t0) * 1000 / double(ns1 - ns0);
+#else
+    return 1000;
+#endif
+  }
+};
+
+} // namespace detail
+
+#endif // TSCCLOCK_H
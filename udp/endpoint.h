@@ -1,26 +1,14 @@
-#ifndef ENDPOINT_H
-#define ENDPOINT_H
+#ifndef UDP_ENDPOINT_H
+#define UDP_ENDPOINT_H
 
-#include <string>
-#include <netinet/in.h>
+#include "genericendpoint.h"
 
 namespace udp
 {
-    
-class Endpoint
-{
-public:
-    Endpoint(const std::string & ip, unsigned short port);
-    
-    Endpoint(const Endpoint & oher);
-    Endpoint(Endpoint && oher);
-    
-    const sockaddr_in & addr() const;
-    
-private:
-    sockaddr_in addr_;
-};
+
+// IPv4, IPv6 or Unix datagram socket address.
+typedef GenericEndpoint Endpoint;
 
 }// namespace udp
 
-#endif // ENDPOINT_H
+#endif // UDP_ENDPOINT_H
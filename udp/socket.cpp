@@ -14,11 +14,11 @@ Socket::Socket(Reactor & reactor, const Endpoint & ep)
     , closed_(true)
 {
     int ec;
-    socket_ = socket_ops::socket(AF_INET, SOCK_DGRAM, 0, ec);
+    socket_ = socket_ops::socket(ep.family(), SOCK_DGRAM, 0, ec);
     throw_error(ec, "create udp socket");
     closed_ = false;
     
-    socket_ops::bind(socket_, (const sockaddr *)&ep.addr(), sizeof(ep.addr()), ec);
+    socket_ops::bind(socket_, ep.data(), ep.size(), ec);
     throw_error(ec, "bind udp socket");
     
     socket_ops::set_non_blocking(socket_, true, ec);
@@ -0,0 +1,219 @@
+#include "watchdog.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <execinfo.h>
+#include <typeinfo>
+
+#include "clock.h"
+#include "logger.h"
+#include "demangle.h"
+#include "systemexception.h"
+
+namespace
+{
+
+// Hand-off between report() and the signal handler on the stalled thread.
+// One capture at a time: only the watchdog thread requests them.
+enum { max_frames = 64 };
+
+enum TraceState
+{
+    trace_idle,
+    trace_requested,
+    trace_done
+};
+
+std::atomic<int> trace_state(trace_idle);
+void * trace_frames[max_frames];
+int trace_size = 0;
+
+void capture_trace(int)
+{
+    if(trace_state.load(std::memory_order_acquire) != trace_requested)
+        return;
+    trace_size = ::backtrace(trace_frames, max_frames);
+    trace_state.store(trace_done, std::memory_order_release);
+}
+
+int64_t monotonic_ms()
+{
+    return MonoClock::now() / MonoClock::ns_per_ms;
+}
+
+}
+
+Watchdog::Watchdog(int stall_ms, int signal)
+    : stall_ms_(stall_ms)
+    , signal_(signal)
+    , stopping_(false)
+    , stalls_(0)
+{
+}
+
+Watchdog::~Watchdog()
+{
+    stop();
+}
+
+void Watchdog::watch(Reactor & reactor)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    Watched w = { &reactor, reactor.heartbeat(), monotonic_ms(), false };
+    watched_.push_back(w);
+}
+
+void Watchdog::unwatch(Reactor & reactor)
+{
+    std::lock_guard<std::mutex> reporting(report_mutex_);
+    std::lock_guard<std::mutex> lock(mutex_);
+    for(size_t i = 0; i < watched_.size(); ++i)
+    {
+        if(watched_[i].reactor == &reactor)
+        {
+            watched_.erase(watched_.begin() + i);
+            break;
+        }
+    }
+}
+
+void Watchdog::start()
+{
+    if(thread_.joinable())
+        return;
+
+    // backtrace() loads libgcc on first use, which is not safe in a signal
+    // handler.
+    void * frame;
+    ::backtrace(&frame, 1);
+
+    struct sigaction sa;
+    sa.sa_handler = capture_trace;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    if(::sigaction(signal_, &sa, &old_action_) == -1)
+        throw_error(errno, "sigaction");
+
+    stopping_ = false;
+    thread_ = std::thread(&Watchdog::run, this);
+}
+
+void Watchdog::stop()
+{
+    if(!thread_.joinable())
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    wakeup_.notify_one();
+    thread_.join();
+    ::sigaction(signal_, &old_action_, 0);
+}
+
+void Watchdog::run()
+{
+    // Checking four times per period reports a stall at most a quarter late.
+    std::chrono::milliseconds period(std::max(stall_ms_ / 4, 1));
+
+    std::vector<Stall> stalled;
+    for(;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            if(stopping_)
+                return;
+            wakeup_.wait_for(lock, period);
+        }
+
+        // Stalls are copied out so watch() and stop() do not wait for the
+        // report; unwatch() does, so the reactors stay valid.
+        std::lock_guard<std::mutex> reporting(report_mutex_);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if(stopping_)
+                return;
+            int64_t now = monotonic_ms();
+            for(Watched & w : watched_)
+            {
+                if(check(w, now))
+                {
+                    Stall stall = { w.reactor, now - w.since_ms };
+                    stalled.push_back(stall);
+                }
+            }
+        }
+
+        for(const Stall & stall : stalled)
+            report(*stall.reactor, stall.stalled_ms);
+        stalled.clear();
+    }
+}
+
+// Whether w has stalled and was not reported yet.
+bool Watchdog::check(Watched & w, int64_t now_ms)
+{
+    Reactor & r = *w.reactor;
+    uint64_t heartbeat = r.heartbeat();
+    if(!r.is_running() || r.is_idle() || heartbeat != w.heartbeat)
+    {
+        w.heartbeat = heartbeat;
+        w.since_ms = now_ms;
+        w.reported = false;
+        return false;
+    }
+
+    if(w.reported || now_ms - w.since_ms < stall_ms_)
+        return false;
+    w.reported = true;
+    ++stalls_;
+    return true;
+}
+
+void Watchdog::report(Reactor & reactor, int64_t stalled_ms)
+{
+    // Only what the reactor published is read: the handler may be gone by
+    // now, and if the loop moved on the two values may not even match.
+    std::string handler = "no handler";
+    int fd = -1;
+    if(const std::type_info * type = reactor.current_type())
+    {
+        handler = detail::demangle(*type);
+        fd = reactor.current_fd();
+    }
+
+    Logger::error() << "reactor thread " << reactor.thread_id() << " stalled for "
+                    << stalled_ms << "ms in " << handler << " fd " << fd;
+
+    trace_state.store(trace_requested, std::memory_order_release);
+    if(::pthread_kill(reactor.thread(), signal_) != 0)
+    {
+        trace_state.store(trace_idle, std::memory_order_relaxed);
+        return;
+    }
+
+    // A thread blocking the signal or stuck in the kernel never answers.
+    for(int i = 0; i < 100 && trace_state.load(std::memory_order_acquire) != trace_done; ++i)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    int expected = trace_requested;
+    if(trace_state.compare_exchange_strong(expected, trace_idle))
+    {
+        Logger::error() << "no stack trace from thread " << reactor.thread_id();
+        return;
+    }
+
+    char ** symbols = ::backtrace_symbols(trace_frames, trace_size);
+    // Frame 0 is the signal handler, frame 1 the signal trampoline.
+    for(int i = 2; i < trace_size; ++i)
+    {
+        if(symbols)
+            Logger::error() << "  #" << i - 2 << " " << symbols[i];
+        else
+            Logger::error() << "  #" << i - 2 << " " << trace_frames[i];
+    }
+    std::free(symbols);
+    trace_state.store(trace_idle, std::memory_order_release);
+}
@@ -0,0 +1,75 @@
+#ifndef WATCHDOG_H
+#define WATCHDOG_H
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <signal.h>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+#include "reactor.h"
+#include "noncopyable.h"
+
+// Background thread noticing reactors that stopped making progress. A loop
+// that is not waiting in epoll_wait and dispatched nothing for stall_ms is
+// reported once per stall with the handler it is stuck in and the stack of
+// its thread, captured by sending the thread signal. The signal handler only
+// records return addresses; symbols are resolved and logged by the watchdog.
+// Link with -rdynamic for function names in the trace.
+class Watchdog : private Noncopyable
+{
+public:
+    explicit Watchdog(int stall_ms = 1000, int signal = SIGUSR2);
+    ~Watchdog();
+
+    // Monitor reactor until unwatch(). Safe to call before or while it runs.
+    // unwatch() waits for a report in progress, so reactor may go right after.
+    void watch(Reactor & reactor);
+    void unwatch(Reactor & reactor);
+
+    void start();
+    void stop();
+
+    // Stalls reported so far.
+    uint64_t stalls() const { return stalls_.load(std::memory_order_relaxed); }
+
+private:
+    struct Watched
+    {
+        Reactor * reactor;
+        uint64_t heartbeat;
+        int64_t since_ms;
+        bool reported;
+    };
+
+    struct Stall
+    {
+        Reactor * reactor;
+        int64_t stalled_ms;
+    };
+
+    void run();
+    bool check(Watched & w, int64_t now_ms);
+    void report(Reactor & reactor, int64_t stalled_ms);
+
+    int stall_ms_;
+    int signal_;
+
+    // The disposition of signal_ before start(), restored by stop().
+    struct sigaction old_action_;
+
+    // Held while reporting, which is done without mutex_ as it sleeps and
+    // logs; taken before mutex_.
+    std::mutex report_mutex_;
+    std::mutex mutex_;
+    std::condition_variable wakeup_;
+    std::vector<Watched> watched_;
+    bool stopping_;
+    std::thread thread_;
+
+    std::atomic<uint64_t> stalls_;
+};
+
+#endif // WATCHDOG_H